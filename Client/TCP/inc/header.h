@@ -9,6 +9,7 @@
 #include <ws2tcpip.h>
 #include <Windows.h>
 #include <iphlpapi.h>
+#include <io.h>
 #define SOCKET_INVALID INVALID_SOCKET
 #else
 #include <sys/socket.h>
@@ -21,7 +22,9 @@
 #endif
 
 #include "../../../TCP/inc/header.h"
+#include "../../../TCP/inc/schema.h"
 #include <memory.h>
+#include <istream>
 
 #pragma comment(lib, "IPHLPAPI.lib")
 
@@ -64,6 +67,7 @@ private:
 
     std::mutex m_handleMutex_;
     std::function<void(DataBuffer_t)> m_dataHandlerFunction = [](const DataBuffer_t&){};
+    std::function<void(const PresenceRecord&)> m_presenceHandlerFunction = [](const PresenceRecord&){};
     ThreadManagementType m_threadManagmentType_;
     ClientThread m_threadClient;
     SockStatusInfo_t m_statusClient_ = SockStatusInfo_t::Disconnected;
@@ -72,11 +76,27 @@ private:
     void HandleThreadPool();
     void JoinThread();
 
+    Frame LoadFrame();
+    void RejectFrame(ProtocolError error);
+
+    FrameLimits m_frameLimits_;
+    std::atomic<uint64_t> m_rejectedFrames_ = 0;
+    void HandleStreamWindow(const DataBuffer_t& payload);
+    void HandlePresence(const DataBuffer_t& payload);
+    bool SendStreamFrom(const std::function<int64_t(uint8_t*, size_t)>& read_source);
+
+    // Credit granted by the server per outgoing stream, replenished by StreamWindow frames.
+    std::mutex m_streamMutex_;
+    std::condition_variable m_streamCondition_;
+    std::unordered_map<uint32_t, uint32_t> m_streamCredits_;
+    std::atomic<uint32_t> m_nextStreamId_ = 0;
+
 
     std::string username_;
 
 public:
     using DataHandleFunctionClient = std::function<void(DataBuffer_t)>;
+    using PresenceHandleFunctionClient = std::function<void(const PresenceRecord&)>;
     Client(std::string  username) noexcept;
     explicit Client(NetworkThreadPool* client_thread_pool, std::string  username) noexcept;
     ~Client() override;
@@ -92,9 +112,23 @@ public:
     DataBuffer_t LoadData() override;
     [[nodiscard]] DataBuffer_t LoadDataSync() const;
     void SetHandler(DataHandleFunctionClient handler);
+    // Presence frames are dispatched from the same receive loop as data, so SetHandler must be running.
+    void SetPresenceHandler(PresenceHandleFunctionClient handler);
+    void SetFrameLimits(const FrameLimits& limits) {m_frameLimits_ = limits;};
+    [[nodiscard]] uint64_t GetRejectedFrameCount() const {return m_rejectedFrames_.load(std::memory_order_relaxed);};
     void JoinHandler() const;
 
     bool SendData(const void* buffer, size_t size) const override;
+    bool SendFrame(FrameType type, const void* buffer, size_t size) const;
+
+    // Stream a body of any length in chunks; window updates arrive through the handler loop,
+    // so SetHandler must have been called before sending more than kStreamInitialWindow bytes.
+    // Fails when the server grants no credit within kSocketIoTimeout.
+    bool SendStream(std::istream& input);
+    bool SendStream(int file_descriptor);
+
+    bool SubscribePresence(const std::string& user, bool subscribe = true) const;
+
     bool SendAuthData() const;
     std::string GeneratePassword() const ;
     [[nodiscard]] ConnectionType GetType() const override { return ConnectionType::Client;}
@@ -216,26 +216,51 @@ TCPInterfaceBase::SockStatusInfo_t Client::ConnectTo(uint32_t host, uint16_t por
 }
 
 DataBuffer_t Client::LoadData() {
+    Frame frame = LoadFrame();
+    switch (frame.type) {
+        case FrameType::Data:
+            return std::move(frame.payload);
+        case FrameType::StreamWindow:
+            HandleStreamWindow(frame.payload);
+            BufferPool::Instance().Release(std::move(frame.payload));
+            return DataBuffer_t();
+        case FrameType::Presence:
+            HandlePresence(frame.payload);
+            BufferPool::Instance().Release(std::move(frame.payload));
+            return DataBuffer_t();
+        case FrameType::Error:
+            if (frame.payload.size() == sizeof(ProtocolError)) {
+                std::cerr << "Server closed the connection, protocol error "
+                          << static_cast<int>(frame.payload[0]) << '\n';
+            }
+            Disconnect();
+            return DataBuffer_t();
+        default:
+            return DataBuffer_t();
+    }
+}
+
+Frame Client::LoadFrame() {
     if (m_statusClient_ != SocketStatusInfo::Connected) {
-        return DataBuffer_t();
+        return Frame();
     }
-    DataBuffer_t dataBuffer;
-    uint32_t size;
+    Frame frame;
+    uint32_t header;
     int error = 0;
 #ifdef _WIN32
     if (u_long t = true; SOCKET_ERROR == ioctlsocket(m_socketClient_, FIONBIO, &t)) {
-        return DataBuffer_t();
+        return Frame();
     }
-    int answer = recv(m_socketClient_, (char *)&size, sizeof(size), 0);
+    int answer = recv(m_socketClient_, (char *)&header, sizeof(header), 0);
     if (u_long t = false; SOCKET_ERROR == ioctlsocket(m_socketClient_, FIONBIO, &t)){
-        return DataBuffer_t();
+        return Frame();
     }
 #else
-    int answer = recv(m_socketClient_, (char *)&size, sizeof(size), MSG_DONTWAIT);
+    int answer = recv(m_socketClient_, (char *)&header, sizeof(header), MSG_DONTWAIT);
 #endif
     if (!answer) {
         Disconnect();
-        return DataBuffer_t();
+        return Frame();
     } else if (answer == -1) {
         WIN (
                 error = convertError();
@@ -261,53 +286,82 @@ DataBuffer_t Client::LoadData() {
                 Disconnect();
                 [[fallthrough]];
             case EAGAIN:
-                return DataBuffer_t();
+                return Frame();
             default:
                 Disconnect();
                 std::cerr << "Unhandled error!\n"
                           << "Code: " << error << " Error: " << std::strerror(error) << '\n';
-                return DataBuffer_t();
+                return Frame();
         }
+    } else if (answer < static_cast<int>(sizeof(header))
+               && !ReceiveExact(m_socketClient_, reinterpret_cast<char*>(&header) + answer, sizeof(header) - answer)) {
+        Disconnect();
+        return Frame();
     }
 
-    if (!size) {
-        return DataBuffer_t();
+    if (ProtocolError error = m_frameLimits_.Validate(header); error != ProtocolError::None) {
+        RejectFrame(error);
+        frame.error = error;
+        return frame;
     }
 
-    if (size > static_cast<uint32_t>(std::numeric_limits<int>::max())) {
-        std::cerr << "DataBuffer size exceeds maximum int value\n";
-        Disconnect();
-        return DataBuffer_t();
+    uint32_t size = GetFrameLength(header);
+    if (!size) {
+        return Frame();
     }
 
-    dataBuffer.resize(static_cast<size_t>(size));
-    int recvResult = recv(m_socketClient_, reinterpret_cast<char*>(dataBuffer.data()), static_cast<int>(dataBuffer.size()), 0);
-    if (recvResult < 0) {
+    frame.type = GetFrameType(header);
+    frame.payload = BufferPool::Instance().Acquire(size);
+    if (!ReceiveExact(m_socketClient_, frame.payload.data(), frame.payload.size())) {
         int err = errno;
         std::cerr << "Error receiving data: " << std::strerror(err) << '\n';
         Disconnect();
-        return DataBuffer_t();
+        return Frame();
     }
 
-    return dataBuffer;
+    return frame;
 }
 
 
 DataBuffer_t Client::LoadDataSync() const {
     DataBuffer_t dataBuffer;
-    uint32_t size = 0;
-    int answer = recv(m_socketClient_, reinterpret_cast<char*>(&size), sizeof(size), 0);
-    if(size && answer == sizeof(size)){
-        if (size > static_cast<uint32_t>(std::numeric_limits<int>::max())) {
-            std::cerr << "DataBuffer size exceeds maximum int value\n";
+    uint32_t header = 0;
+    int answer = recv(m_socketClient_, reinterpret_cast<char*>(&header), sizeof(header), 0);
+    if (m_frameLimits_.Validate(header) != ProtocolError::None) {
+        return DataBuffer_t();
+    }
+    if (uint32_t size = GetFrameLength(header); size && answer == sizeof(header)) {
+        dataBuffer.resize(static_cast<size_t>(size));
+        if (!ReceiveExact(m_socketClient_, dataBuffer.data(), dataBuffer.size())
+            || GetFrameType(header) != FrameType::Data) {
             return DataBuffer_t();
         }
-        dataBuffer.resize(static_cast<size_t>(size));
-        recv(m_socketClient_, reinterpret_cast<char *>(dataBuffer.data()), static_cast<int>(dataBuffer.size()), 0);
     }
     return dataBuffer;
 }
 
+void Client::RejectFrame(ProtocolError error) {
+    m_rejectedFrames_.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "Rejected frame from server, protocol error " << static_cast<int>(error) << '\n';
+    SendFrame(FrameType::Error, &error, sizeof(error));
+    Disconnect();
+}
+
+void Client::HandleStreamWindow(const DataBuffer_t& payload) {
+    uint32_t streamId;
+    uint32_t credit;
+    if (!ParseStreamWindow(payload, streamId, credit)) {
+        return;
+    }
+    {
+        std::lock_guard lockGuard(m_streamMutex_);
+        if (auto it = m_streamCredits_.find(streamId); it != m_streamCredits_.end()) {
+            it->second += credit;
+        }
+    }
+    m_streamCondition_.notify_all();
+}
+
 
 void Client::SetHandler(Client::DataHandleFunctionClient handler) {
     {
@@ -327,6 +381,32 @@ void Client::SetHandler(Client::DataHandleFunctionClient handler) {
     }
 }
 
+void Client::SetPresenceHandler(Client::PresenceHandleFunctionClient handler) {
+    std::lock_guard lockGuard(m_handleMutex_);
+    m_presenceHandlerFunction = std::move(handler);
+}
+
+void Client::HandlePresence(const DataBuffer_t& payload) {
+    PresenceRecord record;
+    if (!PresenceSchema::Decode(payload, record)) {
+        RejectFrame(ProtocolError::MalformedPayload);
+        return;
+    }
+    std::lock_guard lockGuard(m_handleMutex_);
+    m_presenceHandlerFunction(record);
+}
+
+bool Client::SubscribePresence(const std::string& user, bool subscribe) const {
+    PresenceSubscribeRecord request;
+    request.subscribe_ = subscribe;
+    request.user_ = user;
+    DataBuffer_t message = BufferPool::Instance().Acquire(0);
+    bool isSent = PresenceSubscribeSchema::Encode(request, message)
+                  && SendFrame(FrameType::PresenceSubscribe, message.data(), message.size());
+    BufferPool::Instance().Release(std::move(message));
+    return isSent;
+}
+
 void Client::JoinHandler() const {
     switch (m_threadManagmentType_) {
         case Client::ThreadManagementType::SingleThread:
@@ -346,24 +426,89 @@ void Client::JoinHandler() const {
 }
 
 bool Client::SendData(const void *buffer, const size_t size) const {
-    size_t bufferSize = size + sizeof(int);
-    std::vector<char> sendBuffer(bufferSize);
-    *reinterpret_cast<int*>(sendBuffer.data()) = static_cast<int>(size);
-    memcpy(sendBuffer.data() + sizeof(int), buffer, size);
+    return SendFrame(FrameType::Data, buffer, size);
+}
 
-#ifdef _WIN32
-    int bytesSent = send(m_socketClient_, sendBuffer.data(), static_cast<int>(bufferSize), 0);
-    if (bytesSent == SOCKET_ERROR || static_cast<size_t>(bytesSent) != bufferSize) {
+bool Client::SendFrame(FrameType type, const void *buffer, const size_t size) const {
+    if (size > kFrameLengthMask) {
         return false;
     }
-#else
-    ssize_t bytesSent = send(m_socketClient_, sendBuffer.data(), bufferSize, 0);
-    if (bytesSent == -1 || static_cast<size_t>(bytesSent) != bufferSize) {
+    DataBuffer_t sendBuffer = BufferPool::Instance().Acquire(size + sizeof(uint32_t));
+    *reinterpret_cast<uint32_t*>(sendBuffer.data()) = MakeFrameHeader(type, static_cast<uint32_t>(size));
+    memcpy(sendBuffer.data() + sizeof(uint32_t), buffer, size);
+
+    bool isSent = SendExact(m_socketClient_, sendBuffer.data(), sendBuffer.size());
+    BufferPool::Instance().Release(std::move(sendBuffer));
+    return isSent;
+}
+
+bool Client::SendStream(std::istream& input) {
+    return SendStreamFrom([&input](uint8_t* buffer, size_t size) -> int64_t {
+        input.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+        if (input.bad()) {
+            return -1;
+        }
+        return input.gcount();
+    });
+}
+
+bool Client::SendStream(int file_descriptor) {
+    return SendStreamFrom([file_descriptor](uint8_t* buffer, size_t size) -> int64_t {
+        return WINIX(_read(file_descriptor, buffer, static_cast<unsigned>(size)),
+                     read(file_descriptor, buffer, size));
+    });
+}
+
+bool Client::SendStreamFrom(const std::function<int64_t(uint8_t*, size_t)>& read_source) {
+    if (m_statusClient_ != SockStatusInfo_t::Connected) {
         return false;
     }
-#endif
+    uint32_t streamId = ++m_nextStreamId_;
+    {
+        std::lock_guard lockGuard(m_streamMutex_);
+        m_streamCredits_[streamId] = kStreamInitialWindow;
+    }
 
-    return true;
+    DataBuffer_t chunk = BufferPool::Instance().Acquire(kStreamChunkHeaderSize + kStreamChunkSize);
+    memcpy(chunk.data(), &streamId, sizeof(uint32_t));
+    uint8_t flags = kStreamBegin;
+    bool isSent = true;
+
+    while (isSent) {
+        int64_t length = read_source(chunk.data() + kStreamChunkHeaderSize, kStreamChunkSize);
+        if (length < 0) {
+            isSent = false;
+            break;
+        }
+        if (!length) {
+            flags |= kStreamEnd;
+        }
+        {
+            std::unique_lock lock(m_streamMutex_);
+            uint32_t& credit = m_streamCredits_[streamId];
+            auto deadline = std::chrono::steady_clock::now() + kSocketIoTimeout;
+            while (credit < length && m_statusClient_ == SockStatusInfo_t::Connected
+                   && std::chrono::steady_clock::now() < deadline) {
+                m_streamCondition_.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            if (credit < length || m_statusClient_ != SockStatusInfo_t::Connected) {
+                isSent = false;
+                break;
+            }
+            credit -= static_cast<uint32_t>(length);
+        }
+        chunk[sizeof(uint32_t)] = flags;
+        isSent = SendFrame(FrameType::StreamChunk, chunk.data(), kStreamChunkHeaderSize + static_cast<size_t>(length));
+        if (flags & kStreamEnd) {
+            break;
+        }
+        flags = 0;
+    }
+
+    BufferPool::Instance().Release(std::move(chunk));
+    std::lock_guard lockGuard(m_streamMutex_);
+    m_streamCredits_.erase(streamId);
+    return isSent;
 }
 
 
@@ -523,22 +668,18 @@ void Client::GetDataPC() {
     if (!Client::SetDataPc())
         return;
 
-    // Time
-    std::chrono::system_clock::time_point lastRequestTime = std::chrono::system_clock::now();
-    std::time_t t = std::chrono::system_clock::to_time_t(lastRequestTime);
-    char buft[80];
-    std::strftime(buft, sizeof(buft), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
-
-    std::string timeStr(buft);
-
-    // WSend
-    std::string message =   "    (User: "    + m_pcDataReqest_.GetUser()     + " " +
-                            " domain: "   + m_pcDataReqest_.GetDomain()  + " " +
-                            " machine: " + m_pcDataReqest_.GetMachine()  + " " +
-                            " Ip: "      + m_pcDataReqest_.GetIp()       + " " +
-                            " Time: "    + timeStr                       + ")";
-    int messageSize = static_cast<int>(message.size());
-    send(m_socketClient_, message.c_str(), messageSize + 1, 0);
+    PcDataRecord record;
+    record.timestamp_ = CoarseClock::Instance().NowSeconds();
+    record.user_ = m_pcDataReqest_.GetUser();
+    record.domain_ = m_pcDataReqest_.GetDomain();
+    record.machine_ = m_pcDataReqest_.GetMachine();
+    record.ip_ = m_pcDataReqest_.GetIp();
+
+    DataBuffer_t message = BufferPool::Instance().Acquire(0);
+    if (PcDataSchema::Encode(record, message)) {
+        SendFrame(FrameType::Telemetry, message.data(), message.size());
+    }
+    BufferPool::Instance().Release(std::move(message));
 }
 
 bool Client::SetUserName(std::string user) {
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <fstream>
 #include "../Client/TCP/inc/header.h"
 
 
@@ -24,7 +25,7 @@ void runClient(Client& client) {
             std::cerr << "Failed to send auth data\n";
             return;
         }
-        //client.GetDataPC();
+        client.GetDataPC();
         client.SetHandler([&client](DataBuffer_t dataBuffer){
 #ifdef DEBUGLOG
             std::clog << "Recived " << dataBuffer.size() << " bytes: " << (char *)dataBuffer.data() << '\n';
@@ -47,6 +48,9 @@ void clientIOThread(Client& client) {
         std::cout << "Received: " << receivedMessage << std::endl;
 #endif
     });
+    client.SetPresenceHandler([](const PresenceRecord& record) {
+        std::cout << "User " << record.user_ << (record.state_ == PresenceState::Online ? " online" : " offline") << std::endl;
+    });
 
     while (running) {
         std::getline(std::cin, input);
@@ -60,6 +64,17 @@ void clientIOThread(Client& client) {
             } else {
                 std::cout << "Failed to connect to server." << std::endl;
             }
+        } else if (input.rfind("send ", 0) == 0) {
+            std::ifstream file(input.substr(5), std::ios::binary);
+            if (!file) {
+                std::cout << "Failed to open file." << std::endl;
+            } else if (!client.SendStream(file)) {
+                std::cout << "Failed to stream file." << std::endl;
+            }
+        } else if (input.rfind("watch ", 0) == 0) {
+            client.SubscribePresence(input.substr(6));
+        } else if (input.rfind("unwatch ", 0) == 0) {
+            client.SubscribePresence(input.substr(8), false);
         } else if (input == "status") {
             auto status = client.GetStatus();
             std::cout << "Client status: " << static_cast<int>(status) << std::endl;
@@ -0,0 +1,86 @@
+#ifndef ALL_CONNECTION_MANAGER_H
+#define ALL_CONNECTION_MANAGER_H
+
+#include "sqlite3.h"
+#include "statement_cache.h"
+#include "database_profile.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Connections to one database: a single writer and a pool of read-only connections. With WAL
+// every reader sees its own snapshot, so queries from different threads run in parallel instead
+// of queueing on one handle, and never wait for the writer. Each connection keeps its own
+// statement cache, so a query is prepared once per connection, not once per call.
+class ConnectionManager {
+public:
+    struct Connection {
+        sqlite3* handle = nullptr;
+        StatementCache statements;
+    };
+
+    // A reader checked out of the pool; it goes back when the lease is destroyed.
+    class Reader {
+    public:
+        Reader() = default;
+        Reader(ConnectionManager* manager, Connection* connection) : m_manager_(manager), m_connection_(connection) {}
+        Reader(Reader&& other) noexcept;
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        ~Reader();
+
+        explicit operator bool() const {return m_connection_ != nullptr;};
+        [[nodiscard]] sqlite3* GetHandle() const {return m_connection_->handle;};
+        [[nodiscard]] StatementCache& GetStatements() const {return m_connection_->statements;};
+
+    private:
+        ConnectionManager* m_manager_ = nullptr;
+        Connection* m_connection_ = nullptr;
+    };
+
+    explicit ConnectionManager(DatabaseConfig config = {}, size_t readerLimit = 0);
+    ~ConnectionManager();
+
+    ConnectionManager(const ConnectionManager&) = delete;
+    ConnectionManager& operator=(const ConnectionManager&) = delete;
+
+    // Without a writer the database must already exist. Readers are opened on first use.
+    bool Open(bool withWriter = true);
+    // Every reader lease must have been returned.
+    void Close();
+
+    // Only one thread may use the writer at a time.
+    [[nodiscard]] sqlite3* GetWriter() const {return m_writer_.handle;};
+    StatementCache& GetWriterStatements() {return m_writer_.statements;};
+
+    // Waits while every reader is leased; an empty lease means the database is not open.
+    Reader AcquireReader();
+
+    [[nodiscard]] const DatabaseConfig& GetConfig() const {return m_config_;};
+    [[nodiscard]] size_t GetReaderLimit() const {return m_readerLimit_;};
+    [[nodiscard]] size_t GetReaderCount() const;
+    [[nodiscard]] uint64_t GetLeaseCount() const {return m_leases_.load(std::memory_order_relaxed);};
+    [[nodiscard]] uint64_t GetWaitCount() const {return m_waits_.load(std::memory_order_relaxed);};
+
+private:
+    void Release(Connection* connection);
+    bool OpenReader();
+
+    DatabaseConfig m_config_;
+    size_t m_readerLimit_;
+    Connection m_writer_;
+
+    mutable std::mutex m_mutex_;
+    std::condition_variable m_available_;
+    std::vector<std::unique_ptr<Connection>> m_readers_;
+    std::vector<Connection*> m_idle_;
+    bool m_open_ = false;
+
+    std::atomic<uint64_t> m_leases_ = 0;
+    std::atomic<uint64_t> m_waits_ = 0;
+};
+
+#endif //ALL_CONNECTION_MANAGER_H
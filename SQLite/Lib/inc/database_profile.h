@@ -0,0 +1,49 @@
+#ifndef ALL_DATABASE_PROFILE_H
+#define ALL_DATABASE_PROFILE_H
+
+#include "sqlite3.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#define DB_PATH "C:/CLionProjects/ClientServerApp/Server/example.db"
+#else
+#define DB_PATH "/home/alex/CLionProjects/ClientServerApp/Server/example.db"
+#endif
+
+// How much of a commit must reach the disk before it returns. All profiles use WAL, so the
+// reporting tool reads a consistent snapshot while the server keeps inserting.
+//   Safe     - synchronous=FULL, small cache, no mmap: a commit survives power loss.
+//   Balanced - synchronous=NORMAL: the last commits may be lost on power loss, never corrupted.
+//   Fast     - synchronous=OFF, large cache and mmap, rare checkpoints: for bulk loads and tests.
+enum class DurabilityProfile : uint8_t {
+    Safe        = 0,
+    Balanced    = 1,
+    Fast        = 2
+};
+
+// Sessions are stored in one table per day or per month, see session_schema.h.
+enum class PartitionPeriod : uint8_t {
+    Day         = 0,
+    Month       = 1
+};
+
+struct DatabaseConfig {
+    std::string path = DB_PATH;
+    DurabilityProfile profile = DurabilityProfile::Balanced;
+    int busyTimeout = 5000;
+    PartitionPeriod partitionPeriod = PartitionPeriod::Month;
+    // Partitions that ended more than this many days ago are dropped; 0 keeps everything.
+    int retentionDays = 0;
+};
+
+const char* GetProfileName(DurabilityProfile profile);
+bool ParseDurabilityProfile(std::string_view name, DurabilityProfile& profile);
+
+// Readers only take the per-connection settings; journal mode and checkpointing belong to the writer.
+bool ApplyDatabaseConfig(sqlite3* connection, const DatabaseConfig& config, bool reader = false);
+bool CheckpointDatabase(sqlite3* connection, bool truncate = false);
+
+#endif //ALL_DATABASE_PROFILE_H
@@ -2,25 +2,22 @@
 #define ALL_HEADER_H
 
 #include "sqlite3.h"
+#include "statement_cache.h"
+#include "database_profile.h"
+#include "connection_manager.h"
+#include "session_schema.h"
+#include "session_transfer.h"
 #include <iostream>
 #include <string>
-#ifdef _WIN32
-#define DB_PATH "C:/CLionProjects/ClientServerApp/Server/example.db"
-#else
-#define DB_PATH "/home/alex/CLionProjects/ClientServerApp/Server/example.db"
-#endif
 
 
 class DatabaseHandler {
 public:
-    explicit DatabaseHandler(char *dbPath)
-        :   dbPath_(const_cast<char*>(DB_PATH)),
-            dbConnection_(nullptr)
+    explicit DatabaseHandler(DatabaseConfig config = {})
+        :   database_(std::move(config), 1)
     {
-        int rc = sqlite3_open(dbPath_, &dbConnection_);
-        if (rc) {
-            std::cerr << "Can't open database: " << sqlite3_errmsg(dbConnection_) << std::endl;
-            sqlite3_close(dbConnection_);
+        if (database_.Open(false)) {
+            checkSchema();
         }
     }
 
@@ -29,21 +26,23 @@ public:
     }
 
     void readAllFromDatabase();
-    std::string formatTime(int hours, int minutes, int seconds);
+    std::string formatTime(int64_t seconds);
     void calculateConnectionTimeForUser(const std::string& username, const std::string& date);
     void printUserData(const std::string& username);
+    void exportSessions(const std::string& path, SessionExportFormat format);
+    void importSessions(const std::string& path);
 
     void Exit() {
-        if (dbConnection_) {
-            sqlite3_close(dbConnection_);
+        if (database_.GetReaderCount()) {
+            database_.Close();
             std::cout << "Database connection closed." << std::endl;
-            dbConnection_ = nullptr;
         }
     }
 
 private:
-    char *dbPath_;
-    sqlite3* dbConnection_;
+    void checkSchema();
+
+    ConnectionManager database_;
 };
 
 
@@ -0,0 +1,100 @@
+#ifndef ALL_SESSION_SCHEMA_H
+#define ALL_SESSION_SCHEMA_H
+
+#include "sqlite3.h"
+#include "statement_cache.h"
+#include "database_profile.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Schema versions are kept in PRAGMA user_version.
+//   1 - legacy UserInfo table: every column TEXT, no key, no index.
+//   2 - one Sessions table: epoch seconds and durations as INTEGER, rowid key, indexes on
+//       (username, day) and connectTime. `day` is the local calendar date as days since 1970-01-01.
+//   3 - the v2 columns split over one table per day or month, named after the first day they
+//       cover (Sessions_YYYYMMDD) and listed with their day range in SessionPartitions. Sessions
+//       is a UNION ALL view over them for queries across partitions; a query for one day only
+//       needs the partition that covers it, and old partitions are retired by dropping them.
+// Older databases are upgraded online: the new tables are created at once and the writer then
+// moves the old rows over in batches, each in its own short transaction, until the old table
+// (UserInfo, or Sessions renamed to SessionsV2) is dropped.
+constexpr int kSessionSchemaVersion = 3;
+constexpr size_t kMigrationBatchSize = 8192;
+// SQLite's default limit on the terms of a compound SELECT; older partitions drop out of the view,
+// so the reports read the partitions directly.
+constexpr size_t kMaxViewPartitions = 500;
+
+int64_t SessionDayFromEpoch(int64_t epoch, int64_t utcOffset);
+// Accepts YYYY-MM-DD.
+bool ParseSessionDay(std::string_view date, int64_t& day);
+
+int GetSchemaVersion(sqlite3* connection);
+bool HasLegacySessions(sqlite3* connection);
+// Partitions holding rows of [firstDay, lastDay], oldest first.
+std::vector<std::string> FindSessionPartitions(sqlite3* connection, int64_t firstDay, int64_t lastDay);
+
+struct SessionRow {
+    std::string_view username;
+    std::string_view password;      // empty is stored as NULL
+    uint16_t sessionPort = 0;
+    int64_t connectTime = 0;
+    int64_t disconnectTime = 0;     // zero while the session is open, stored as NULL with the duration
+    int64_t duration = 0;
+    int64_t day = 0;
+};
+
+// The partitions of the writer connection. Partitions never overlap: one that would is cut short
+// at its neighbours, which only happens after switching between day and month partitions.
+class SessionPartitions {
+public:
+    struct Partition {
+        std::string name;
+        int64_t firstDay;
+        int64_t lastDay;
+        std::string insert;
+    };
+
+    SessionPartitions(sqlite3* connection, StatementCache& statements, PartitionPeriod period);
+
+    // Creates or upgrades the schema and the partition for today.
+    bool Initialize(int64_t today);
+    // Re-reads the partition list, e.g. after a transaction that created partitions rolled back.
+    bool Reload();
+
+    // Both run inside the caller's write transaction; a missing partition is created.
+    const Partition* Resolve(int64_t day);
+    bool Insert(const SessionRow& row);
+
+    // Creates today's and tomorrow's partitions ahead of the first insert, then drops those that
+    // ended more than retentionDays ago (0 keeps everything). Runs its own transaction.
+    bool Rotate(int64_t today, int retentionDays);
+    // A bulk load drops the indexes of the partitions it fills and builds them once at the end.
+    // Initialize rebuilds any that an interrupted load left missing.
+    bool DropIndexes(const Partition& partition);
+    bool CreateIndexes(const Partition& partition);
+    // Moves up to batchSize legacy rows into their partitions and drops the legacy table once it
+    // is empty. Returns the rows moved, 0 when nothing is left, or -1 on error.
+    int64_t MigrateLegacy(size_t batchSize = kMigrationBatchSize);
+
+    [[nodiscard]] size_t Size() const {return m_partitions_.size();};
+    [[nodiscard]] uint64_t GetRetiredCount() const {return m_retired_;};
+
+private:
+    const Partition* Find(int64_t day);
+    const Partition* Create(int64_t day);
+    bool RebuildView();
+
+    sqlite3* m_connection_;
+    StatementCache& m_statements_;
+    PartitionPeriod m_period_;
+    std::map<int64_t, Partition> m_partitions_;
+    const Partition* m_last_ = nullptr;
+    uint64_t m_retired_ = 0;
+    bool m_viewTruncated_ = false;
+};
+
+#endif //ALL_SESSION_SCHEMA_H
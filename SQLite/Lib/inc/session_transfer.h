@@ -0,0 +1,86 @@
+#ifndef ALL_SESSION_TRANSFER_H
+#define ALL_SESSION_TRANSFER_H
+
+#include "session_schema.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Session export files, for moving sessions between databases in bulk.
+//   binary - an 8-byte header (magic "SCSX", version), then per session a fixed part
+//            (ports and lengths as uint16, times as int64, little-endian) and the
+//            username and password bytes.
+//   csv    - a header line with the column names, then one line per session. Times are epoch
+//            seconds and day is days since 1970-01-01, as in the database; NULL is an empty field.
+// Import tells them apart by the magic.
+constexpr uint32_t kSessionExportMagic = 0x58534353;
+constexpr uint32_t kSessionExportVersion = 1;
+// Rows per import transaction.
+constexpr size_t kImportBatchSize = 1 << 18;
+
+enum class SessionExportFormat : uint8_t {
+    Binary      = 0,
+    Csv         = 1
+};
+
+// Accepts binary or csv.
+bool ParseSessionExportFormat(std::string_view name, SessionExportFormat& format);
+
+class SessionExportWriter {
+public:
+    SessionExportWriter() = default;
+    ~SessionExportWriter();
+
+    SessionExportWriter(const SessionExportWriter&) = delete;
+    SessionExportWriter& operator=(const SessionExportWriter&) = delete;
+
+    bool Open(const std::string& path, SessionExportFormat format);
+    // Rows whose username or password do not fit the format are skipped and return false.
+    bool Write(const SessionRow& row);
+    // Write errors surface here, once the buffered rows are flushed.
+    bool Close();
+
+private:
+    std::FILE* m_file_ = nullptr;
+    SessionExportFormat m_format_ = SessionExportFormat::Binary;
+    std::string m_line_;
+};
+
+class SessionImportReader {
+public:
+    enum class Result : uint8_t {
+        Row         = 0,
+        Invalid     = 1,
+        End         = 2
+    };
+
+    SessionImportReader() = default;
+    ~SessionImportReader();
+
+    SessionImportReader(const SessionImportReader&) = delete;
+    SessionImportReader& operator=(const SessionImportReader&) = delete;
+
+    bool Open(const std::string& path);
+    // The row refers to storage of the reader and stays valid until the next call.
+    Result Next(SessionRow& row);
+
+    [[nodiscard]] SessionExportFormat GetFormat() const {return m_format_;};
+    // The line of a CSV file or the record of a binary file last read, counting from 1.
+    [[nodiscard]] uint64_t GetPosition() const {return m_position_;};
+
+private:
+    Result NextBinary(SessionRow& row);
+    Result NextCsv(SessionRow& row);
+    bool ReadLine();
+
+    std::FILE* m_file_ = nullptr;
+    SessionExportFormat m_format_ = SessionExportFormat::Binary;
+    uint64_t m_position_ = 0;
+    std::string m_line_;
+    std::vector<std::string> m_fields_;
+};
+
+#endif //ALL_SESSION_TRANSFER_H
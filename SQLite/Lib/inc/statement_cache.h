@@ -0,0 +1,59 @@
+#ifndef ALL_STATEMENT_CACHE_H
+#define ALL_STATEMENT_CACHE_H
+
+#include "sqlite3.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+// Prepared statements of one connection, keyed by their SQL text. A statement is prepared on
+// first use and afterwards only reset and rebound. Like the connection itself, a cache must be
+// used by one thread at a time.
+class StatementCache {
+public:
+    // Hands out a cached statement; it is reset and its bindings cleared when the handle goes away.
+    class Statement {
+    public:
+        explicit Statement(sqlite3_stmt* statement = nullptr) : m_statement_(statement) {}
+        Statement(Statement&& other) noexcept : m_statement_(other.m_statement_) {other.m_statement_ = nullptr;}
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+        ~Statement();
+
+        explicit operator bool() const {return m_statement_ != nullptr;};
+        operator sqlite3_stmt*() const {return m_statement_;};
+
+    private:
+        sqlite3_stmt* m_statement_;
+    };
+
+    explicit StatementCache(sqlite3* connection = nullptr) : m_connection_(connection) {}
+    ~StatementCache();
+
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    // Finalizes every cached statement; required before the connection can be closed.
+    void Clear();
+    // Finalizes one statement, e.g. once the table it refers to has been dropped.
+    void Forget(std::string_view sql);
+    void SetConnection(sqlite3* connection);
+
+    Statement Acquire(std::string_view sql);
+    // Runs a statement without parameters or result rows, e.g. BEGIN or COMMIT.
+    int Execute(std::string_view sql);
+
+    [[nodiscard]] size_t Size() const {return m_statements_.size();};
+    [[nodiscard]] uint64_t GetHitCount() const {return m_hits_;};
+    [[nodiscard]] uint64_t GetPrepareCount() const {return m_prepares_;};
+
+private:
+    sqlite3* m_connection_;
+    std::map<std::string, sqlite3_stmt*, std::less<>> m_statements_;
+    uint64_t m_hits_ = 0;
+    uint64_t m_prepares_ = 0;
+};
+
+#endif //ALL_STATEMENT_CACHE_H
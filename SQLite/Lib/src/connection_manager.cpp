@@ -0,0 +1,117 @@
+#include "../inc/connection_manager.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+ConnectionManager::Reader::Reader(Reader&& other) noexcept
+        :   m_manager_(other.m_manager_),
+            m_connection_(other.m_connection_)
+{
+    other.m_manager_ = nullptr;
+    other.m_connection_ = nullptr;
+}
+
+ConnectionManager::Reader::~Reader() {
+    if (m_connection_) {
+        m_manager_->Release(m_connection_);
+    }
+}
+
+ConnectionManager::ConnectionManager(DatabaseConfig config, size_t readerLimit)
+        :   m_config_(std::move(config)),
+            m_readerLimit_(readerLimit ? readerLimit : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+ConnectionManager::~ConnectionManager() {
+    Close();
+}
+
+bool ConnectionManager::Open(bool withWriter) {
+    std::lock_guard lock(m_mutex_);
+    if (m_open_) {
+        return true;
+    }
+    if (withWriter) {
+        if (sqlite3_open(m_config_.path.c_str(), &m_writer_.handle) != SQLITE_OK) {
+            std::cerr << "Can't open database: " << sqlite3_errmsg(m_writer_.handle) << std::endl;
+            sqlite3_close(m_writer_.handle);
+            m_writer_.handle = nullptr;
+            return false;
+        }
+        ApplyDatabaseConfig(m_writer_.handle, m_config_);
+        m_writer_.statements.SetConnection(m_writer_.handle);
+    }
+    m_open_ = true;
+    // Without a writer, open one reader right away so a wrong path is reported up front.
+    if (!withWriter && !OpenReader()) {
+        m_open_ = false;
+        return false;
+    }
+    return true;
+}
+
+void ConnectionManager::Close() {
+    std::unique_lock lock(m_mutex_);
+    for (auto& reader : m_readers_) {
+        reader->statements.Clear();
+        sqlite3_close(reader->handle);
+    }
+    m_readers_.clear();
+    m_idle_.clear();
+    m_writer_.statements.Clear();
+    sqlite3_close(m_writer_.handle);
+    m_writer_.handle = nullptr;
+    m_open_ = false;
+    lock.unlock();
+    m_available_.notify_all();
+}
+
+size_t ConnectionManager::GetReaderCount() const {
+    std::lock_guard lock(m_mutex_);
+    return m_readers_.size();
+}
+
+bool ConnectionManager::OpenReader() {
+    auto reader = std::make_unique<Connection>();
+    if (sqlite3_open_v2(m_config_.path.c_str(), &reader->handle, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        std::cerr << "Can't open database: " << sqlite3_errmsg(reader->handle) << std::endl;
+        sqlite3_close(reader->handle);
+        return false;
+    }
+    ApplyDatabaseConfig(reader->handle, m_config_, true);
+    reader->statements.SetConnection(reader->handle);
+    m_idle_.push_back(reader.get());
+    m_readers_.push_back(std::move(reader));
+    return true;
+}
+
+ConnectionManager::Reader ConnectionManager::AcquireReader() {
+    std::unique_lock lock(m_mutex_);
+    if (!m_open_) {
+        return {};
+    }
+    if (m_idle_.empty() && m_readers_.size() < m_readerLimit_ && !OpenReader() && m_readers_.empty()) {
+        return {};
+    }
+    if (m_idle_.empty()) {
+        m_waits_.fetch_add(1, std::memory_order_relaxed);
+        m_available_.wait(lock, [this] {return !m_idle_.empty() || !m_open_;});
+        if (!m_open_) {
+            return {};
+        }
+    }
+    Connection* connection = m_idle_.back();
+    m_idle_.pop_back();
+    m_leases_.fetch_add(1, std::memory_order_relaxed);
+    return {this, connection};
+}
+
+void ConnectionManager::Release(Connection* connection) {
+    {
+        std::lock_guard lock(m_mutex_);
+        m_idle_.push_back(connection);
+    }
+    m_available_.notify_one();
+}
@@ -0,0 +1,68 @@
+#include "../inc/database_profile.h"
+
+#include <iostream>
+
+struct ProfileSettings {
+    const char* name;
+    const char* synchronous;
+    int cacheKibibytes;
+    int64_t mmapSize;
+    int autoCheckpointPages;
+};
+
+static const ProfileSettings kProfiles[] = {
+        {"safe",     "FULL",   2 * 1024,  0,                  1000},
+        {"balanced", "NORMAL", 16 * 1024, 64ll * 1024 * 1024,  1000},
+        {"fast",     "OFF",    64 * 1024, 256ll * 1024 * 1024, 10000},
+};
+
+static bool ExecutePragma(sqlite3* connection, const std::string& pragma) {
+    char* errorMsg = nullptr;
+    if (sqlite3_exec(connection, pragma.c_str(), nullptr, nullptr, &errorMsg) != SQLITE_OK) {
+        std::cerr << "SQL error: " << (errorMsg ? errorMsg : sqlite3_errmsg(connection)) << " (" << pragma << ")" << std::endl;
+        sqlite3_free(errorMsg);
+        return false;
+    }
+    return true;
+}
+
+const char* GetProfileName(DurabilityProfile profile) {
+    return kProfiles[static_cast<size_t>(profile)].name;
+}
+
+bool ParseDurabilityProfile(std::string_view name, DurabilityProfile& profile) {
+    for (size_t i = 0; i < std::size(kProfiles); ++i) {
+        if (name == kProfiles[i].name) {
+            profile = static_cast<DurabilityProfile>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ApplyDatabaseConfig(sqlite3* connection, const DatabaseConfig& config, bool reader) {
+    if (!connection) {
+        return false;
+    }
+    const ProfileSettings& settings = kProfiles[static_cast<size_t>(config.profile)];
+    sqlite3_busy_timeout(connection, config.busyTimeout);
+
+    bool applied = ExecutePragma(connection, "PRAGMA cache_size = -" + std::to_string(settings.cacheKibibytes))
+                   && ExecutePragma(connection, "PRAGMA mmap_size = " + std::to_string(settings.mmapSize))
+                   && ExecutePragma(connection, "PRAGMA temp_store = MEMORY");
+    if (reader || !applied) {
+        return applied;
+    }
+    return ExecutePragma(connection, "PRAGMA journal_mode = WAL")
+           && ExecutePragma(connection, std::string("PRAGMA synchronous = ") + settings.synchronous)
+           && ExecutePragma(connection, "PRAGMA wal_autocheckpoint = " + std::to_string(settings.autoCheckpointPages))
+           && ExecutePragma(connection, "PRAGMA journal_size_limit = " + std::to_string(64 * 1024 * 1024));
+}
+
+bool CheckpointDatabase(sqlite3* connection, bool truncate) {
+    if (!connection) {
+        return false;
+    }
+    return sqlite3_wal_checkpoint_v2(connection, nullptr, truncate ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE,
+                                     nullptr, nullptr) == SQLITE_OK;
+}
@@ -0,0 +1,400 @@
+#include "../inc/session_schema.h"
+
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <set>
+
+static bool ExecuteSql(sqlite3* connection, const std::string& sql) {
+    char* errorMsg = nullptr;
+    if (sqlite3_exec(connection, sql.c_str(), nullptr, nullptr, &errorMsg) != SQLITE_OK) {
+        std::cerr << "SQL error: " << (errorMsg ? errorMsg : sqlite3_errmsg(connection)) << std::endl;
+        sqlite3_free(errorMsg);
+        return false;
+    }
+    return true;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date.
+static int64_t DaysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    auto yearOfEra = static_cast<unsigned>(year - era * 400);
+    unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+}
+
+static void CivilFromDays(int64_t days, int64_t& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    auto dayOfEra = static_cast<unsigned>(days - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned monthIndex = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+}
+
+static bool HasTable(sqlite3* connection, const char* name) {
+    sqlite3_stmt* stmt = nullptr;
+    bool found = false;
+    if (sqlite3_prepare_v2(connection, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?", -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        found = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+static const char* const kSessionColumns = "username, password, sessionPort, connectTime, disconnectTime, duration, day";
+
+// Legacy times are local "YYYY-MM-DD HH:MM:SS" text, durations "HH:MM:SS" where the hours may
+// have more than two digits. Rows that do not parse keep NULL instead of a bogus number.
+static const char* const kLegacyColumns =
+        "COALESCE(username, ''), password, COALESCE(sessionPort, 0),"
+        " COALESCE(CAST(strftime('%s', connectTime, 'utc') AS INTEGER), 0),"
+        " CAST(strftime('%s', NULLIF(disconnectTime, ''), 'utc') AS INTEGER),"
+        " CASE WHEN duration LIKE '%:__:__' THEN CAST(substr(duration, 1, length(duration) - 6) AS INTEGER) * 3600"
+        "  + CAST(substr(duration, -5, 2) AS INTEGER) * 60 + CAST(substr(duration, -2) AS INTEGER) END,"
+        " COALESCE(CAST(julianday(COALESCE(NULLIF(timeToday, ''), date(connectTime))) - 2440587.5 AS INTEGER), 0)";
+
+int64_t SessionDayFromEpoch(int64_t epoch, int64_t utcOffset) {
+    int64_t local = epoch + utcOffset;
+    return local >= 0 ? local / 86400 : (local - 86399) / 86400;
+}
+
+bool ParseSessionDay(std::string_view date, int64_t& day) {
+    static constexpr unsigned kMonthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int year, month, dayOfMonth, length = 0;
+    std::string text(date);
+    if (sscanf(text.c_str(), "%4d-%2d-%2d%n", &year, &month, &dayOfMonth, &length) != 3
+        || static_cast<size_t>(length) != text.size()
+        || month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > static_cast<int>(kMonthDays[month - 1])) {
+        return false;
+    }
+    bool leapYear = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (month == 2 && dayOfMonth == 29 && !leapYear) {
+        return false;
+    }
+    day = DaysFromCivil(year, month, dayOfMonth);
+    return true;
+}
+
+int GetSchemaVersion(sqlite3* connection) {
+    sqlite3_stmt* stmt = nullptr;
+    int version = -1;
+    if (sqlite3_prepare_v2(connection, "PRAGMA user_version", -1, &stmt, nullptr) == SQLITE_OK
+        && sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+bool HasLegacySessions(sqlite3* connection) {
+    return HasTable(connection, "UserInfo") || HasTable(connection, "SessionsV2");
+}
+
+std::vector<std::string> FindSessionPartitions(sqlite3* connection, int64_t firstDay, int64_t lastDay) {
+    std::vector<std::string> partitions;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(connection, "SELECT name FROM SessionPartitions WHERE firstDay <= ? AND lastDay >= ? ORDER BY firstDay",
+                           -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, lastDay);
+        sqlite3_bind_int64(stmt, 2, firstDay);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            partitions.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        }
+    }
+    sqlite3_finalize(stmt);
+    return partitions;
+}
+
+SessionPartitions::SessionPartitions(sqlite3* connection, StatementCache& statements, PartitionPeriod period)
+        :   m_connection_(connection),
+            m_statements_(statements),
+            m_period_(period)
+{
+}
+
+bool SessionPartitions::Initialize(int64_t today) {
+    if (!m_connection_) {
+        return false;
+    }
+    int version = GetSchemaVersion(m_connection_);
+    if (version > kSessionSchemaVersion) {
+        std::cerr << "Database schema v" << version << " is newer than this build (v" << kSessionSchemaVersion << ")" << std::endl;
+        return false;
+    }
+    if (!ExecuteSql(m_connection_, "BEGIN IMMEDIATE")) {
+        return false;
+    }
+    bool created = true;
+    if (version < kSessionSchemaVersion) {
+        created = (version != 2 || !HasTable(m_connection_, "Sessions") || ExecuteSql(m_connection_, "ALTER TABLE Sessions RENAME TO SessionsV2"))
+                  && ExecuteSql(m_connection_, "CREATE TABLE IF NOT EXISTS SessionPartitions ("
+                                               "name TEXT PRIMARY KEY,"
+                                               "firstDay INTEGER NOT NULL,"
+                                               "lastDay INTEGER NOT NULL"
+                                               ")")
+                  && ExecuteSql(m_connection_, "PRAGMA user_version = " + std::to_string(kSessionSchemaVersion));
+    }
+    created = created && Reload();
+    for (auto it = m_partitions_.begin(); created && it != m_partitions_.end(); ++it) {
+        created = CreateIndexes(it->second);
+    }
+    created = created && Resolve(today);
+    if (!created) {
+        ExecuteSql(m_connection_, "ROLLBACK");
+        Reload();
+        return false;
+    }
+    return ExecuteSql(m_connection_, "COMMIT");
+}
+
+// Partitions still listed keep their entry, so ones resolved earlier in a transaction stay valid;
+// the others lose their cached insert.
+bool SessionPartitions::Reload() {
+    m_last_ = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(m_connection_, "SELECT name, firstDay, lastDay FROM SessionPartitions", -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    std::map<int64_t, Partition> listed;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Partition partition;
+        partition.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        partition.firstDay = sqlite3_column_int64(stmt, 1);
+        partition.lastDay = sqlite3_column_int64(stmt, 2);
+        partition.insert = "INSERT INTO \"" + partition.name + "\" (" + kSessionColumns + ") VALUES (?, ?, ?, ?, ?, ?, ?)";
+        listed.emplace(partition.firstDay, std::move(partition));
+    }
+    sqlite3_finalize(stmt);
+    for (auto it = m_partitions_.begin(); it != m_partitions_.end();) {
+        auto found = listed.find(it->first);
+        if (found == listed.end() || found->second.name != it->second.name || found->second.lastDay != it->second.lastDay) {
+            m_statements_.Forget(it->second.insert);
+            it = m_partitions_.erase(it);
+        } else {
+            listed.erase(found);
+            ++it;
+        }
+    }
+    m_partitions_.merge(listed);
+    return true;
+}
+
+const SessionPartitions::Partition* SessionPartitions::Find(int64_t day) {
+    auto it = m_partitions_.upper_bound(day);
+    if (it != m_partitions_.begin() && std::prev(it)->second.lastDay >= day) {
+        m_last_ = &std::prev(it)->second;
+        return m_last_;
+    }
+    return nullptr;
+}
+
+const SessionPartitions::Partition* SessionPartitions::Resolve(int64_t day) {
+    if (m_last_ && day >= m_last_->firstDay && day <= m_last_->lastDay) {
+        return m_last_;
+    }
+    if (const Partition* partition = Find(day)) {
+        return partition;
+    }
+    return Create(day);
+}
+
+// Runs in the write transaction, so after the reload the list is the one in the database, with
+// partitions another connection (an import) created since it was last read.
+const SessionPartitions::Partition* SessionPartitions::Create(int64_t day) {
+    if (!Reload()) {
+        return nullptr;
+    }
+    if (const Partition* partition = Find(day)) {
+        return partition;
+    }
+    int64_t year;
+    unsigned month, dayOfMonth;
+    CivilFromDays(day, year, month, dayOfMonth);
+    int64_t firstDay = day;
+    int64_t lastDay = day;
+    if (m_period_ == PartitionPeriod::Month) {
+        firstDay = DaysFromCivil(year, month, 1);
+        lastDay = DaysFromCivil(month == 12 ? year + 1 : year, month == 12 ? 1 : month + 1, 1) - 1;
+    }
+    auto next = m_partitions_.upper_bound(day);
+    if (next != m_partitions_.end()) {
+        lastDay = std::min(lastDay, next->second.firstDay - 1);
+    }
+    if (next != m_partitions_.begin()) {
+        firstDay = std::max(firstDay, std::prev(next)->second.lastDay + 1);
+    }
+
+    CivilFromDays(firstDay, year, month, dayOfMonth);
+    char name[32];
+    snprintf(name, sizeof(name), "Sessions_%04lld%02u%02u", static_cast<long long>(year), month, dayOfMonth);
+    std::string table = std::string("\"") + name + "\"";
+    bool created = ExecuteSql(m_connection_, "CREATE TABLE IF NOT EXISTS " + table + " ("
+                                             "id INTEGER PRIMARY KEY,"
+                                             "username TEXT NOT NULL,"
+                                             "password TEXT,"
+                                             "sessionPort INTEGER NOT NULL,"
+                                             "connectTime INTEGER NOT NULL,"
+                                             "disconnectTime INTEGER,"
+                                             "duration INTEGER,"
+                                             "day INTEGER NOT NULL"
+                                             ")")
+                   && ExecuteSql(m_connection_, "INSERT OR IGNORE INTO SessionPartitions (name, firstDay, lastDay) VALUES ('" + std::string(name) + "', "
+                                                + std::to_string(firstDay) + ", " + std::to_string(lastDay) + ")");
+    if (!created) {
+        return nullptr;
+    }
+    if (!sqlite3_changes(m_connection_)) {
+        // Listed under this name already: use it if it covers the day.
+        const Partition* partition = Reload() ? Find(day) : nullptr;
+        if (!partition) {
+            std::cerr << "Partition " << name << " is listed but does not cover day " << day << std::endl;
+        }
+        return partition;
+    }
+    Partition partition{name, firstDay, lastDay, "INSERT INTO " + table + " (" + kSessionColumns + ") VALUES (?, ?, ?, ?, ?, ?, ?)"};
+    m_last_ = &m_partitions_.emplace(firstDay, std::move(partition)).first->second;
+    const Partition* partitionCreated = m_last_;
+    return CreateIndexes(*partitionCreated) && RebuildView() ? partitionCreated : nullptr;
+}
+
+bool SessionPartitions::DropIndexes(const Partition& partition) {
+    return ExecuteSql(m_connection_, "DROP INDEX IF EXISTS \"" + partition.name + "_ByUserDay\"")
+           && ExecuteSql(m_connection_, "DROP INDEX IF EXISTS \"" + partition.name + "_ByConnectTime\"");
+}
+
+bool SessionPartitions::CreateIndexes(const Partition& partition) {
+    std::string table = "\"" + partition.name + "\"";
+    return ExecuteSql(m_connection_, "CREATE INDEX IF NOT EXISTS \"" + partition.name + "_ByUserDay\" ON " + table + " (username, day)")
+           && ExecuteSql(m_connection_, "CREATE INDEX IF NOT EXISTS \"" + partition.name + "_ByConnectTime\" ON " + table + " (connectTime)");
+}
+
+bool SessionPartitions::RebuildView() {
+    if (!ExecuteSql(m_connection_, "DROP VIEW IF EXISTS Sessions")) {
+        return false;
+    }
+    std::vector<std::string> partitions = FindSessionPartitions(m_connection_, std::numeric_limits<int64_t>::min(),
+                                                                std::numeric_limits<int64_t>::max());
+    if (partitions.empty()) {
+        return true;
+    }
+    bool truncated = partitions.size() > kMaxViewPartitions;
+    if (truncated && !m_viewTruncated_) {
+        std::cerr << "The Sessions view only covers the newest " << kMaxViewPartitions << " of " << partitions.size()
+                  << " partitions; the reports read all of them" << std::endl;
+    }
+    m_viewTruncated_ = truncated;
+    if (truncated) {
+        partitions.erase(partitions.begin(), partitions.end() - kMaxViewPartitions);
+    }
+    std::string view = "CREATE VIEW Sessions AS ";
+    for (const std::string& partition : partitions) {
+        view += partition == partitions.front() ? "" : " UNION ALL ";
+        view += "SELECT id, " + std::string(kSessionColumns) + " FROM \"" + partition + "\"";
+    }
+    return ExecuteSql(m_connection_, view);
+}
+
+bool SessionPartitions::Insert(const SessionRow& row) {
+    const Partition* partition = Resolve(row.day);
+    if (!partition) {
+        return false;
+    }
+    StatementCache::Statement stmt = m_statements_.Acquire(partition->insert);
+    if (!stmt) {
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, row.username.data(), static_cast<int>(row.username.size()), SQLITE_STATIC);
+    if (!row.password.empty()) {
+        sqlite3_bind_text(stmt, 2, row.password.data(), static_cast<int>(row.password.size()), SQLITE_STATIC);
+    }
+    sqlite3_bind_int(stmt, 3, row.sessionPort);
+    sqlite3_bind_int64(stmt, 4, row.connectTime);
+    if (row.disconnectTime) {
+        sqlite3_bind_int64(stmt, 5, row.disconnectTime);
+        sqlite3_bind_int64(stmt, 6, row.duration);
+    }
+    sqlite3_bind_int64(stmt, 7, row.day);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "Error executing SQL statement: " << sqlite3_errmsg(m_connection_) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SessionPartitions::Rotate(int64_t today, int retentionDays) {
+    if (!m_connection_ || !ExecuteSql(m_connection_, "BEGIN IMMEDIATE")) {
+        return false;
+    }
+    bool rotated = Reload() && Resolve(today) && Resolve(today + 1);
+    size_t retired = 0;
+    if (rotated && retentionDays > 0) {
+        int64_t oldest = today - retentionDays;
+        for (auto it = m_partitions_.begin(); rotated && it != m_partitions_.end() && it->second.lastDay < oldest;) {
+            m_statements_.Forget(it->second.insert);
+            rotated = ExecuteSql(m_connection_, "DROP TABLE \"" + it->second.name + "\"")
+                      && ExecuteSql(m_connection_, "DELETE FROM SessionPartitions WHERE name = '" + it->second.name + "'");
+            it = m_partitions_.erase(it);
+            ++retired;
+        }
+        rotated = rotated && (!retired || RebuildView());
+    }
+    if (!rotated || !ExecuteSql(m_connection_, "COMMIT")) {
+        ExecuteSql(m_connection_, "ROLLBACK");
+        Reload();
+        return false;
+    }
+    m_retired_ += retired;
+    return true;
+}
+
+int64_t SessionPartitions::MigrateLegacy(size_t batchSize) {
+    const char* source = HasTable(m_connection_, "UserInfo") ? "UserInfo" : HasTable(m_connection_, "SessionsV2") ? "SessionsV2" : nullptr;
+    if (!source) {
+        return 0;
+    }
+    std::string batch = std::string("SELECT rowid FROM ") + source + " ORDER BY rowid LIMIT " + std::to_string(batchSize);
+    std::string columns = source == std::string_view("UserInfo") ? kLegacyColumns : kSessionColumns;
+
+    if (!ExecuteSql(m_connection_, "BEGIN IMMEDIATE")) {
+        return -1;
+    }
+    int64_t moved = -1;
+    bool staged = ExecuteSql(m_connection_, std::string("CREATE TEMP TABLE IF NOT EXISTS MigrationBatch (") + kSessionColumns + ")")
+                  && ExecuteSql(m_connection_, "DELETE FROM temp.MigrationBatch")
+                  && ExecuteSql(m_connection_, "INSERT INTO temp.MigrationBatch SELECT " + columns + " FROM " + source + " WHERE rowid IN (" + batch + ")");
+    if (staged) {
+        moved = sqlite3_changes(m_connection_);
+        std::set<const Partition*> partitions;
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(m_connection_, "SELECT DISTINCT day FROM temp.MigrationBatch", -1, &stmt, nullptr) == SQLITE_OK) {
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                partitions.insert(Resolve(sqlite3_column_int64(stmt, 0)));
+            }
+        }
+        sqlite3_finalize(stmt);
+        staged = !partitions.count(nullptr);
+        for (auto it = partitions.begin(); staged && it != partitions.end(); ++it) {
+            staged = ExecuteSql(m_connection_, "INSERT INTO \"" + (*it)->name + "\" (" + kSessionColumns + ") SELECT " + kSessionColumns
+                                               + " FROM temp.MigrationBatch WHERE day BETWEEN " + std::to_string((*it)->firstDay)
+                                               + " AND " + std::to_string((*it)->lastDay));
+        }
+        staged = staged
+                 && ExecuteSql(m_connection_, std::string("DELETE FROM ") + source + " WHERE rowid IN (" + batch + ")")
+                 && (static_cast<size_t>(moved) == batchSize || ExecuteSql(m_connection_, std::string("DROP TABLE ") + source));
+    }
+    if (!staged || !ExecuteSql(m_connection_, "COMMIT")) {
+        ExecuteSql(m_connection_, "ROLLBACK");
+        Reload();
+        return -1;
+    }
+    // Another legacy table may follow: UserInfo goes first, then SessionsV2.
+    return static_cast<size_t>(moved) < batchSize && HasLegacySessions(m_connection_) ? static_cast<int64_t>(batchSize) : moved;
+}
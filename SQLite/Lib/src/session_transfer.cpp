@@ -0,0 +1,293 @@
+#include "../inc/session_transfer.h"
+
+#include <charconv>
+#include <iostream>
+#include <type_traits>
+
+static constexpr size_t kTransferBufferSize = 1 << 20;
+static constexpr size_t kBinaryRecordSize = 3 * sizeof(uint16_t) + 4 * sizeof(int64_t);
+static constexpr size_t kCsvColumns = 7;
+static const char* const kCsvHeader = "username,password,sessionPort,connectTime,disconnectTime,duration,day";
+
+bool ParseSessionExportFormat(std::string_view name, SessionExportFormat& format) {
+    if (name == "binary") {
+        format = SessionExportFormat::Binary;
+    } else if (name == "csv") {
+        format = SessionExportFormat::Csv;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Binary exports are little-endian whatever the host, so they move between machines.
+template <typename T>
+static void AppendValue(std::string& buffer, T value) {
+    using Bits = std::make_unsigned_t<T>;
+    auto bits = static_cast<Bits>(value);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        buffer += static_cast<char>(bits >> (8 * i) & 0xFF);
+    }
+}
+
+template <typename T>
+static T ReadValue(const char*& data) {
+    using Bits = std::make_unsigned_t<T>;
+    Bits bits = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        bits = static_cast<Bits>(bits | static_cast<Bits>(static_cast<uint8_t>(data[i])) << (8 * i));
+    }
+    data += sizeof(T);
+    return static_cast<T>(bits);
+}
+
+static void AppendNumber(std::string& line, int64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    line.append(digits, result.ptr);
+}
+
+static void AppendCsvField(std::string& line, std::string_view field) {
+    if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+        line.append(field);
+        return;
+    }
+    line += '"';
+    for (char c : field) {
+        if (c == '"') {
+            line += '"';
+        }
+        line += c;
+    }
+    line += '"';
+}
+
+static bool ParseNumber(const std::string& field, int64_t& value) {
+    auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc() && result.ptr == field.data() + field.size();
+}
+
+SessionExportWriter::~SessionExportWriter() {
+    Close();
+}
+
+bool SessionExportWriter::Open(const std::string& path, SessionExportFormat format) {
+    Close();
+    m_format_ = format;
+    m_file_ = std::fopen(path.c_str(), "wb");
+    if (!m_file_) {
+        std::cerr << "Can't open export file " << path << std::endl;
+        return false;
+    }
+    std::setvbuf(m_file_, nullptr, _IOFBF, kTransferBufferSize);
+    m_line_.clear();
+    if (m_format_ == SessionExportFormat::Binary) {
+        AppendValue(m_line_, kSessionExportMagic);
+        AppendValue(m_line_, kSessionExportVersion);
+    } else {
+        m_line_.append(kCsvHeader).append("\n");
+    }
+    return std::fwrite(m_line_.data(), 1, m_line_.size(), m_file_) == m_line_.size();
+}
+
+bool SessionExportWriter::Write(const SessionRow& row) {
+    m_line_.clear();
+    if (m_format_ == SessionExportFormat::Binary) {
+        if (row.username.size() > UINT16_MAX || row.password.size() > UINT16_MAX) {
+            return false;
+        }
+        AppendValue(m_line_, static_cast<uint16_t>(row.username.size()));
+        AppendValue(m_line_, static_cast<uint16_t>(row.password.size()));
+        AppendValue(m_line_, row.sessionPort);
+        AppendValue(m_line_, row.connectTime);
+        AppendValue(m_line_, row.disconnectTime);
+        AppendValue(m_line_, row.duration);
+        AppendValue(m_line_, row.day);
+        m_line_.append(row.username).append(row.password);
+    } else {
+        AppendCsvField(m_line_, row.username);
+        m_line_ += ',';
+        AppendCsvField(m_line_, row.password);
+        m_line_ += ',';
+        AppendNumber(m_line_, row.sessionPort);
+        m_line_ += ',';
+        AppendNumber(m_line_, row.connectTime);
+        m_line_ += ',';
+        if (row.disconnectTime) {
+            AppendNumber(m_line_, row.disconnectTime);
+            m_line_ += ',';
+            AppendNumber(m_line_, row.duration);
+        } else {
+            m_line_ += ',';
+        }
+        m_line_ += ',';
+        AppendNumber(m_line_, row.day);
+        m_line_ += '\n';
+    }
+    std::fwrite(m_line_.data(), 1, m_line_.size(), m_file_);
+    return true;
+}
+
+bool SessionExportWriter::Close() {
+    if (!m_file_) {
+        return true;
+    }
+    bool written = std::ferror(m_file_) == 0;
+    written = std::fclose(m_file_) == 0 && written;
+    m_file_ = nullptr;
+    return written;
+}
+
+SessionImportReader::~SessionImportReader() {
+    if (m_file_) {
+        std::fclose(m_file_);
+    }
+}
+
+bool SessionImportReader::Open(const std::string& path) {
+    if (m_file_) {
+        std::fclose(m_file_);
+    }
+    m_position_ = 0;
+    m_file_ = std::fopen(path.c_str(), "rb");
+    if (!m_file_) {
+        std::cerr << "Can't open import file " << path << std::endl;
+        return false;
+    }
+    std::setvbuf(m_file_, nullptr, _IOFBF, kTransferBufferSize);
+
+    char header[2 * sizeof(uint32_t)];
+    size_t read = std::fread(header, 1, sizeof(header), m_file_);
+    const char* data = header;
+    if (read == sizeof(header) && ReadValue<uint32_t>(data) == kSessionExportMagic) {
+        m_format_ = SessionExportFormat::Binary;
+        if (auto version = ReadValue<uint32_t>(data); version != kSessionExportVersion) {
+            std::cerr << "Unsupported export version " << version << std::endl;
+            return false;
+        }
+        return true;
+    }
+    m_format_ = SessionExportFormat::Csv;
+    std::rewind(m_file_);
+    if (!ReadLine() || m_line_ != kCsvHeader) {
+        std::cerr << "Unknown import format, expected a session export or CSV starting with: " << kCsvHeader << std::endl;
+        return false;
+    }
+    return true;
+}
+
+SessionImportReader::Result SessionImportReader::Next(SessionRow& row) {
+    if (!m_file_) {
+        return Result::End;
+    }
+    return m_format_ == SessionExportFormat::Binary ? NextBinary(row) : NextCsv(row);
+}
+
+SessionImportReader::Result SessionImportReader::NextBinary(SessionRow& row) {
+    char record[kBinaryRecordSize];
+    size_t read = std::fread(record, 1, sizeof(record), m_file_);
+    if (read == 0) {
+        return Result::End;
+    }
+    ++m_position_;
+    if (read != sizeof(record)) {
+        return Result::Invalid;
+    }
+    const char* data = record;
+    auto usernameLength = ReadValue<uint16_t>(data);
+    auto passwordLength = ReadValue<uint16_t>(data);
+    row.sessionPort = ReadValue<uint16_t>(data);
+    row.connectTime = ReadValue<int64_t>(data);
+    row.disconnectTime = ReadValue<int64_t>(data);
+    row.duration = ReadValue<int64_t>(data);
+    row.day = ReadValue<int64_t>(data);
+
+    m_line_.resize(usernameLength + passwordLength);
+    if (std::fread(m_line_.data(), 1, m_line_.size(), m_file_) != m_line_.size() || !usernameLength) {
+        return Result::Invalid;
+    }
+    row.username = std::string_view(m_line_).substr(0, usernameLength);
+    row.password = std::string_view(m_line_).substr(usernameLength);
+    return Result::Row;
+}
+
+// A quoted field may span lines; quotes inside it are doubled.
+SessionImportReader::Result SessionImportReader::NextCsv(SessionRow& row) {
+    if (!ReadLine()) {
+        return Result::End;
+    }
+    m_fields_.resize(kCsvColumns);
+    size_t field = 0;
+    m_fields_[0].clear();
+    bool quoted = false;
+    for (size_t i = 0;; ++i) {
+        if (i == m_line_.size()) {
+            if (!quoted) {
+                break;
+            }
+            m_fields_[field] += '\n';
+            if (!ReadLine()) {
+                return Result::Invalid;
+            }
+            i = static_cast<size_t>(-1);
+            continue;
+        }
+        char c = m_line_[i];
+        if (quoted) {
+            if (c != '"') {
+                m_fields_[field] += c;
+            } else if (i + 1 < m_line_.size() && m_line_[i + 1] == '"') {
+                m_fields_[field] += '"';
+                ++i;
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            if (++field == kCsvColumns) {
+                return Result::Invalid;
+            }
+            m_fields_[field].clear();
+        } else {
+            m_fields_[field] += c;
+        }
+    }
+
+    int64_t port = 0;
+    int64_t disconnectTime = 0;
+    int64_t duration = 0;
+    if (field + 1 != kCsvColumns || m_fields_[0].empty()
+        || !ParseNumber(m_fields_[2], port) || port < 0 || port > UINT16_MAX
+        || !ParseNumber(m_fields_[3], row.connectTime)
+        || (!m_fields_[4].empty() && !ParseNumber(m_fields_[4], disconnectTime))
+        || (!m_fields_[5].empty() && !ParseNumber(m_fields_[5], duration))
+        || !ParseNumber(m_fields_[6], row.day)) {
+        return Result::Invalid;
+    }
+    row.username = m_fields_[0];
+    row.password = m_fields_[1];
+    row.sessionPort = static_cast<uint16_t>(port);
+    row.disconnectTime = disconnectTime;
+    row.duration = duration;
+    return Result::Row;
+}
+
+bool SessionImportReader::ReadLine() {
+    char chunk[4096];
+    m_line_.clear();
+    while (std::fgets(chunk, sizeof(chunk), m_file_)) {
+        m_line_.append(chunk);
+        if (!m_line_.empty() && m_line_.back() == '\n') {
+            break;
+        }
+    }
+    if (m_line_.empty()) {
+        return false;
+    }
+    ++m_position_;
+    while (!m_line_.empty() && (m_line_.back() == '\n' || m_line_.back() == '\r')) {
+        m_line_.pop_back();
+    }
+    return true;
+}
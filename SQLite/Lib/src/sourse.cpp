@@ -1,137 +1,323 @@
 #include "../inc/header.h"
 
-void DatabaseHandler::readAllFromDatabase() {
-    sqlite3* dbConnection;
-    int rc = sqlite3_open(dbPath_, &dbConnection);
-    if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
+#include <chrono>
+#include <ctime>
+#include <limits>
+
+static const char* ColumnText(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? reinterpret_cast<const char*>(text) : "";
+}
+
+void DatabaseHandler::checkSchema() {
+    ConnectionManager::Reader reader = database_.AcquireReader();
+    if (!reader) {
         return;
     }
+    int version = GetSchemaVersion(reader.GetHandle());
+    if (version < kSessionSchemaVersion) {
+        std::cerr << "Database schema is v" << version << ", start the server once to upgrade it to v"
+                  << kSessionSchemaVersion << std::endl;
+    } else if (HasLegacySessions(reader.GetHandle())) {
+        std::cout << "Legacy sessions are still being migrated, reports may be incomplete." << std::endl;
+    }
+}
 
-    sqlite3_stmt* stmt;
-    const char* selectSQL = "SELECT * FROM UserInfo";
-
-    rc = sqlite3_prepare_v2(dbConnection, selectSQL, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
+void DatabaseHandler::readAllFromDatabase() {
+    int rc = SQLITE_DONE;
+    ConnectionManager::Reader reader = database_.AcquireReader();
+    if (!reader) {
         return;
     }
+    // Read partition by partition rather than through the view, which only covers the newest
+    // kMaxViewPartitions; one read transaction keeps them consistent with each other.
+    sqlite3* connection = reader.GetHandle();
+    sqlite3_exec(connection, "BEGIN", nullptr, nullptr, nullptr);
+    for (const std::string& partition : FindSessionPartitions(connection, std::numeric_limits<int64_t>::min(),
+                                                             std::numeric_limits<int64_t>::max())) {
+        std::string sql = "SELECT username, password, sessionPort, datetime(connectTime, 'unixepoch', 'localtime'),"
+                          " datetime(disconnectTime, 'unixepoch', 'localtime'), duration, date(day * 86400, 'unixepoch') "
+                          "FROM \"" + partition + "\" ORDER BY connectTime";
+        sqlite3_stmt* stmt = nullptr;
+        if ((rc = sqlite3_prepare_v2(connection, sql.c_str(), -1, &stmt, nullptr)) != SQLITE_OK) {
+            break;
+        }
 
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        std::cout << "Time: " << sqlite3_column_text(stmt, 6) << std::endl;
-        std::cout << "Username: " << sqlite3_column_text(stmt, 0) << std::endl;
-        std::cout << "Port: " << sqlite3_column_text(stmt, 2) << std::endl;
-        std::cout << "Connection Time: " << sqlite3_column_text(stmt, 3) << std::endl;
-        std::cout << "Disconnection Time: " << sqlite3_column_text(stmt, 4) << std::endl;
-        std::cout << "Duration: " << sqlite3_column_text(stmt, 5) << std::endl;
-        std::cout << "Password: " << sqlite3_column_text(stmt, 1) << std::endl;
-        std::cout << "---------------------------------------------------------" << std::endl;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            std::cout << "Time: " << ColumnText(stmt, 6) << std::endl;
+            std::cout << "Username: " << ColumnText(stmt, 0) << std::endl;
+            std::cout << "Port: " << sqlite3_column_int(stmt, 2) << std::endl;
+            std::cout << "Connection Time: " << ColumnText(stmt, 3) << std::endl;
+            std::cout << "Disconnection Time: " << ColumnText(stmt, 4) << std::endl;
+            std::cout << "Duration: " << (sqlite3_column_type(stmt, 5) == SQLITE_NULL ? "" : formatTime(sqlite3_column_int64(stmt, 5))) << std::endl;
+            std::cout << "Password: " << ColumnText(stmt, 1) << std::endl;
+            std::cout << "---------------------------------------------------------" << std::endl;
+        }
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) {
+            break;
+        }
     }
 
     if (rc != SQLITE_DONE) {
-        std::cerr << "Error reading from database: " << sqlite3_errmsg(dbConnection) << std::endl;
+        std::cerr << "Error reading from database: " << sqlite3_errmsg(connection) << std::endl;
     }
-
-    sqlite3_finalize(stmt);
-    sqlite3_close(dbConnection);
+    sqlite3_exec(connection, "COMMIT", nullptr, nullptr, nullptr);
 }
 
-std::string DatabaseHandler::formatTime(int hours, int minutes, int seconds) {
-    char buffer[9];
-    snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", hours, minutes, seconds);
+std::string DatabaseHandler::formatTime(int64_t seconds) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%02lld:%02d:%02d", static_cast<long long>(seconds / 3600),
+             static_cast<int>(seconds / 60 % 60), static_cast<int>(seconds % 60));
     return std::string(buffer);
 }
 
 void DatabaseHandler::calculateConnectionTimeForUser(const std::string &username, const std::string &date) {
-    sqlite3* dbConnection;
-    int rc = sqlite3_open(dbPath_, &dbConnection);
-    if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
+    int rc;
+    int64_t day;
+    if (!ParseSessionDay(date, day)) {
+        std::cout << "Invalid date '" << date << "', expected YYYY-MM-DD" << std::endl;
         return;
     }
 
-    std::string selectSQL = "SELECT duration FROM UserInfo WHERE username = ? AND timeToday = ?";
-    sqlite3_stmt* stmt;
-
-    rc = sqlite3_prepare_v2(dbConnection, selectSQL.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
+    ConnectionManager::Reader reader = database_.AcquireReader();
+    if (!reader) {
         return;
     }
+    // Only the partitions that cover the day are read, not the view over all of them. Partitions
+    // come and go, so their queries are not kept in the reader's statement cache.
+    sqlite3* connection = reader.GetHandle();
+    int64_t totalSeconds = 0;
+    for (const std::string& partition : FindSessionPartitions(connection, day, day)) {
+        std::string sql = "SELECT COALESCE(SUM(duration), 0) FROM \"" + partition + "\" WHERE username = ? AND day = ?";
+        sqlite3_stmt* stmt = nullptr;
+        if ((rc = sqlite3_prepare_v2(connection, sql.c_str(), -1, &stmt, nullptr)) != SQLITE_OK) {
+            std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(connection) << std::endl;
+            sqlite3_finalize(stmt);
+            return;
+        }
 
-    rc = sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-    rc = sqlite3_bind_text(stmt, 2, date.c_str(), -1, SQLITE_STATIC);
+        rc = sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+        rc = sqlite3_bind_int64(stmt, 2, day);
 
-    int totalHours = 0;
-    int totalMinutes = 0;
-    int totalSeconds = 0;
+        if ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            totalSeconds += sqlite3_column_int64(stmt, 0);
+        } else {
+            std::cerr << "Error reading from database: " << sqlite3_errmsg(connection) << std::endl;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    std::cout << "Total connection time for user " << username << " on " << date << ": "
+              << formatTime(totalSeconds) << std::endl;
+}
+
+void DatabaseHandler::printUserData(const std::string &username) {
+    int rc = SQLITE_DONE;
+    ConnectionManager::Reader reader = database_.AcquireReader();
+    if (!reader) {
+        return;
+    }
+    // Every partition, oldest first, as in readAllFromDatabase.
+    sqlite3* connection = reader.GetHandle();
+    sqlite3_exec(connection, "BEGIN", nullptr, nullptr, nullptr);
+    for (const std::string& partition : FindSessionPartitions(connection, std::numeric_limits<int64_t>::min(),
+                                                             std::numeric_limits<int64_t>::max())) {
+        std::string sql = "SELECT username, sessionPort, datetime(connectTime, 'unixepoch', 'localtime'),"
+                          " datetime(disconnectTime, 'unixepoch', 'localtime'), duration, date(day * 86400, 'unixepoch') "
+                          "FROM \"" + partition + "\" WHERE username = ? ORDER BY day, connectTime";
+        sqlite3_stmt* stmt = nullptr;
+        if ((rc = sqlite3_prepare_v2(connection, sql.c_str(), -1, &stmt, nullptr)) != SQLITE_OK) {
+            break;
+        }
 
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        const unsigned char* durationStr = sqlite3_column_text(stmt, 0);
-        std::string durationString(reinterpret_cast<const char*>(durationStr));
+        rc = sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
 
-        int hours, minutes, seconds;
-        sscanf(durationString.c_str(), "%d:%d:%d", &hours, &minutes, &seconds);
-        totalHours += hours;
-        totalMinutes += minutes;
-        totalSeconds += seconds;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            std::cout << "Username: " << ColumnText(stmt, 0) << std::endl;
+            std::cout << "SessionPort: " << sqlite3_column_int(stmt, 1) << std::endl;
+            std::cout << "ConnectTime: " << ColumnText(stmt, 2) << std::endl;
+            std::cout << "DisconnectTime: " << ColumnText(stmt, 3) << std::endl;
+            std::cout << "Duration: " << (sqlite3_column_type(stmt, 4) == SQLITE_NULL ? "" : formatTime(sqlite3_column_int64(stmt, 4))) << std::endl;
+            std::cout << "TimeToday: " << ColumnText(stmt, 5) << std::endl;
+            std::cout << "---------------------------------------------" << std::endl;
+        }
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) {
+            break;
+        }
     }
 
     if (rc != SQLITE_DONE) {
-        std::cerr << "Error reading from database: " << sqlite3_errmsg(dbConnection) << std::endl;
+        std::cerr << "Error reading from database: " << sqlite3_errmsg(connection) << std::endl;
     }
+    sqlite3_exec(connection, "COMMIT", nullptr, nullptr, nullptr);
+}
 
-    totalMinutes += totalSeconds / 60;
-    totalSeconds %= 60;
-    totalHours += totalMinutes / 60;
-    totalMinutes %= 60;
-
-    std::cout << "Total connection time for user " << username << " on " << date << ": "
-              << formatTime(totalHours, totalMinutes, totalSeconds) << std::endl;
+static int64_t ElapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(dbConnection);
+static std::string_view ColumnView(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? std::string_view(reinterpret_cast<const char*>(text), sqlite3_column_bytes(stmt, column)) : std::string_view();
 }
 
-void DatabaseHandler::printUserData(const std::string &username) {
-    sqlite3* dbConnection;
-    int rc = sqlite3_open(dbPath_, &dbConnection);
-    if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
+void DatabaseHandler::exportSessions(const std::string& path, SessionExportFormat format) {
+    auto started = std::chrono::steady_clock::now();
+    ConnectionManager::Reader reader = database_.AcquireReader();
+    if (!reader) {
+        return;
+    }
+    SessionExportWriter writer;
+    if (!writer.Open(path, format)) {
         return;
     }
 
-    std::string selectSQL = "SELECT * FROM UserInfo WHERE username = ?";
-    sqlite3_stmt* stmt;
+    // One read transaction, so the file is a consistent snapshot across partitions.
+    sqlite3* connection = reader.GetHandle();
+    sqlite3_exec(connection, "BEGIN", nullptr, nullptr, nullptr);
+    uint64_t exported = 0;
+    uint64_t skipped = 0;
+    bool read = true;
+    for (const std::string& partition : FindSessionPartitions(connection, std::numeric_limits<int64_t>::min(),
+                                                             std::numeric_limits<int64_t>::max())) {
+        sqlite3_stmt* stmt = nullptr;
+        std::string sql = "SELECT username, password, sessionPort, connectTime, disconnectTime, duration, day FROM \"" + partition + "\"";
+        if (sqlite3_prepare_v2(connection, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            read = false;
+            break;
+        }
+        int rc;
+        SessionRow row;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            row.username = ColumnView(stmt, 0);
+            row.password = ColumnView(stmt, 1);
+            row.sessionPort = static_cast<uint16_t>(sqlite3_column_int(stmt, 2));
+            row.connectTime = sqlite3_column_int64(stmt, 3);
+            row.disconnectTime = sqlite3_column_int64(stmt, 4);
+            row.duration = sqlite3_column_int64(stmt, 5);
+            row.day = sqlite3_column_int64(stmt, 6);
+            if (writer.Write(row)) {
+                ++exported;
+            } else {
+                ++skipped;
+            }
+        }
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) {
+            read = false;
+            break;
+        }
+    }
+    if (!read) {
+        std::cerr << "Error reading from database: " << sqlite3_errmsg(connection) << std::endl;
+    }
+    sqlite3_exec(connection, "COMMIT", nullptr, nullptr, nullptr);
 
-    rc = sqlite3_prepare_v2(dbConnection, selectSQL.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
+    if (!writer.Close()) {
+        std::cerr << "Error writing export file " << path << std::endl;
         return;
     }
+    std::cout << "Exported " << exported << " sessions to " << path << " in " << ElapsedMilliseconds(started) << " ms";
+    if (skipped) {
+        std::cout << ", skipped " << skipped << " that do not fit the format";
+    }
+    std::cout << std::endl;
+}
+
+static int64_t LocalToday() {
+    std::time_t now = std::time(nullptr);
+    char date[16];
+    int64_t day = 0;
+    std::strftime(date, sizeof(date), "%Y-%m-%d", std::localtime(&now));
+    ParseSessionDay(date, day);
+    return day;
+}
 
-    rc = sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+// Rows go straight into their partitions through the writer connection, kImportBatchSize rows per
+// transaction. Partitions the import creates are filled without their indexes, which are then
+// built once over the loaded rows instead of being updated row by row. Partitions that already
+// existed keep theirs, even when empty: the server may be writing today's sessions into them.
+void DatabaseHandler::importSessions(const std::string& path) {
+    auto started = std::chrono::steady_clock::now();
+    SessionImportReader reader;
+    if (!reader.Open(path)) {
+        return;
+    }
+    ConnectionManager database(database_.GetConfig(), 1);
+    if (!database.Open()) {
+        return;
+    }
+    sqlite3* connection = database.GetWriter();
+    StatementCache& statements = database.GetWriterStatements();
+    SessionPartitions partitions(connection, statements, database.GetConfig().partitionPeriod);
+    int64_t today = LocalToday();
+    if (!partitions.Initialize(today)) {
+        std::cerr << "Failed to initialize the session schema: " << sqlite3_errmsg(connection) << std::endl;
+        return;
+    }
 
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        std::cout << "Username: " << sqlite3_column_text(stmt, 0) << std::endl;
-        std::cout << "SessionPort: " << sqlite3_column_int(stmt, 2) << std::endl;
-        std::cout << "ConnectTime: " << sqlite3_column_text(stmt, 3) << std::endl;
-        std::cout << "DisconnectTime: " << sqlite3_column_text(stmt, 4) << std::endl;
-        std::cout << "Duration: " << sqlite3_column_text(stmt, 5) << std::endl;
-        std::cout << "TimeToday: " << sqlite3_column_text(stmt, 6) << std::endl;
-        std::cout << "---------------------------------------------" << std::endl;
+    const char* unit = reader.GetFormat() == SessionExportFormat::Csv ? "line" : "record";
+    size_t deferred = 0;
+    const SessionPartitions::Partition* last = nullptr;
+    uint64_t imported = 0;
+    uint64_t pending = 0;
+    uint64_t rejected = 0;
+    SessionRow row;
+    SessionImportReader::Result result;
+    bool loaded = statements.Execute("BEGIN IMMEDIATE") == SQLITE_OK;
+    while (loaded && (result = reader.Next(row)) != SessionImportReader::Result::End) {
+        if (result == SessionImportReader::Result::Invalid) {
+            if (rejected++ < 10) {
+                std::cerr << "Skipping invalid " << unit << " " << reader.GetPosition() << std::endl;
+            }
+            continue;
+        }
+        // Inside the write transaction the catalog is current, so a day it does not cover yet gets
+        // a partition of the import's own.
+        bool created = (!last || row.day < last->firstDay || row.day > last->lastDay)
+                       && FindSessionPartitions(connection, row.day, row.day).empty();
+        const SessionPartitions::Partition* partition = partitions.Resolve(row.day);
+        if (partition != last) {
+            last = partition;
+            loaded = partition != nullptr;
+            if (loaded && created) {
+                loaded = partitions.DropIndexes(*partition);
+                ++deferred;
+            }
+        }
+        loaded = loaded && partitions.Insert(row);
+        if (loaded && ++pending == kImportBatchSize) {
+            loaded = statements.Execute("COMMIT") == SQLITE_OK;
+            if (loaded) {
+                imported += pending;
+                pending = 0;
+                loaded = statements.Execute("BEGIN IMMEDIATE") == SQLITE_OK;
+            }
+        }
+    }
+    if (loaded && statements.Execute("COMMIT") == SQLITE_OK) {
+        imported += pending;
+    } else {
+        std::cerr << "Import stopped at " << unit << " " << reader.GetPosition() << ": " << sqlite3_errmsg(connection) << std::endl;
+        statements.Execute("ROLLBACK");
+        partitions.Reload();
     }
+    auto loadedIn = ElapsedMilliseconds(started);
 
-    if (rc != SQLITE_DONE) {
-        std::cerr << "Error reading from database: " << sqlite3_errmsg(dbConnection) << std::endl;
+    // Initialize builds every index that is missing, including the ones deferred above.
+    if (!partitions.Initialize(today)) {
+        std::cerr << "Failed to build the session indexes, they are built at the next start: " << sqlite3_errmsg(connection) << std::endl;
+    }
+    std::cout << "Imported " << imported << " sessions from " << path << " in " << loadedIn << " ms, indexes of "
+              << deferred << " partitions built in " << ElapsedMilliseconds(started) - loadedIn << " ms";
+    if (rejected) {
+        std::cout << ", rejected " << rejected << " invalid " << unit << "s";
     }
+    std::cout << std::endl;
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(dbConnection);
+    database.Close();
+    // The database may only exist now.
+    database_.Open(false);
 }
@@ -0,0 +1,61 @@
+#include "../inc/statement_cache.h"
+
+#include <iostream>
+
+StatementCache::Statement::~Statement() {
+    if (m_statement_) {
+        sqlite3_reset(m_statement_);
+        sqlite3_clear_bindings(m_statement_);
+    }
+}
+
+StatementCache::~StatementCache() {
+    Clear();
+}
+
+void StatementCache::Clear() {
+    for (auto& [sql, statement] : m_statements_) {
+        sqlite3_finalize(statement);
+    }
+    m_statements_.clear();
+}
+
+void StatementCache::Forget(std::string_view sql) {
+    if (auto it = m_statements_.find(sql); it != m_statements_.end()) {
+        sqlite3_finalize(it->second);
+        m_statements_.erase(it);
+    }
+}
+
+void StatementCache::SetConnection(sqlite3* connection) {
+    Clear();
+    m_connection_ = connection;
+}
+
+StatementCache::Statement StatementCache::Acquire(std::string_view sql) {
+    if (auto it = m_statements_.find(sql); it != m_statements_.end()) {
+        ++m_hits_;
+        return Statement(it->second);
+    }
+    if (!m_connection_) {
+        return Statement();
+    }
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(m_connection_, sql.data(), static_cast<int>(sql.size()), &statement, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(m_connection_) << std::endl;
+        sqlite3_finalize(statement);
+        return Statement();
+    }
+    ++m_prepares_;
+    m_statements_.emplace(sql, statement);
+    return Statement(statement);
+}
+
+int StatementCache::Execute(std::string_view sql) {
+    Statement statement = Acquire(sql);
+    if (!statement) {
+        return SQLITE_ERROR;
+    }
+    int rc = sqlite3_step(statement);
+    return rc == SQLITE_DONE || rc == SQLITE_ROW ? SQLITE_OK : rc;
+}
@@ -22,6 +22,8 @@ void DataBaseIOThread(DatabaseHandler &db) {
     std::cout << "printAll - Print all data from the database" << std::endl;
     std::cout << "calculateTime <username> <date> - Calculate connection time for a user on a specific date" << std::endl;
     std::cout << "printUserData <username> - Print user data" << std::endl;
+    std::cout << "export <file> [binary|csv] - Write all sessions to a file" << std::endl;
+    std::cout << "import <file> - Load sessions from an exported binary or CSV file" << std::endl;
     std::cout << "help - Show available commands" << std::endl;
 
     while (!exitRequested) {
@@ -38,6 +40,8 @@ void DataBaseIOThread(DatabaseHandler &db) {
             std::cout << "printAll - Print all data from the database" << std::endl;
             std::cout << "calculateTime <username> <date> - Calculate connection time for a user on a specific date" << std::endl;
             std::cout << "printUserData <username> - Print user data" << std::endl;
+            std::cout << "export <file> [binary|csv] - Write all sessions to a file" << std::endl;
+            std::cout << "import <file> - Load sessions from an exported binary or CSV file" << std::endl;
             std::cout << "help - Show available commands" << std::endl;
         } else if (command.find("calculateTime") == 0) {
             std::istringstream iss(command);
@@ -57,15 +61,43 @@ void DataBaseIOThread(DatabaseHandler &db) {
             } else {
                 db.printUserData(tokens[1]);
             }
+        } else if (command.find("export") == 0) {
+            std::istringstream iss(command);
+            std::vector<std::string> tokens(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>());
+            SessionExportFormat format = SessionExportFormat::Binary;
+
+            if (tokens.size() < 2 || tokens.size() > 3 || (tokens.size() == 3 && !ParseSessionExportFormat(tokens[2], format))) {
+                std::cout << "Invalid command syntax. Usage: export <file> [binary|csv]" << std::endl;
+            } else {
+                db.exportSessions(tokens[1], format);
+            }
+        } else if (command.find("import") == 0) {
+            std::istringstream iss(command);
+            std::vector<std::string> tokens(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>());
+
+            if (tokens.size() != 2) {
+                std::cout << "Invalid command syntax. Usage: import <file>" << std::endl;
+            } else {
+                db.importSessions(tokens[1]);
+            }
         } else {
             std::cout << "Unknown command. Type 'help' to see available commands." << std::endl;
         }
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     std::cout << "Hello, World, Iam DataBase" << std::endl;
-    DatabaseHandler db(DB_PATH);
+
+    DatabaseConfig config;
+    if (argc > 1) {
+        config.path = argv[1];
+    }
+    if (argc > 2 && !ParseDurabilityProfile(argv[2], config.profile)) {
+        std::cerr << "Unknown profile '" << argv[2] << "', expected safe, balanced or fast" << std::endl;
+        return 1;
+    }
+    DatabaseHandler db(config);
 
     std::thread ThreadDataBase(DataBaseIOThread, std::ref(db));
 
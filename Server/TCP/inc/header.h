@@ -2,14 +2,20 @@
 #define ALL_HEADER_SERVER_H
 
 #include <functional>
+#include <algorithm>
+#include <filesystem>
 #include <cstring>
+#include <cstdio>
 
 #include <list>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <deque>
 
 #include <chrono>
 
@@ -24,6 +30,7 @@
 #ifdef _WIN32 // Lib NT
 #include <WinSock2.h>
 #include <mstcpip.h>
+#include <io.h>
 #else // *nix
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -35,13 +42,24 @@
 #endif
 
 #ifdef _WIN32
-#define DB_PATH "C:/CLionProjects/ClientServerApp/Server/example.db"
+#define SNAPSHOT_PATH "C:/CLionProjects/ClientServerApp/Server/server.snapshot"
+#define SESSION_LOG_PATH "C:/CLionProjects/ClientServerApp/Server/sessions.bin"
+#define SESSION_JOURNAL_PATH "C:/CLionProjects/ClientServerApp/Server/journal"
+#define SESSION_SPOOL_PATH "C:/CLionProjects/ClientServerApp/Server/sessions.spool"
 #else
-#define DB_PATH "/home/alex/CLionProjects/ClientServerApp/Server/example.db"
+#define SNAPSHOT_PATH "/home/alex/CLionProjects/ClientServerApp/Server/server.snapshot"
+#define SESSION_LOG_PATH "/home/alex/CLionProjects/ClientServerApp/Server/sessions.bin"
+#define SESSION_JOURNAL_PATH "/home/alex/CLionProjects/ClientServerApp/Server/journal"
+#define SESSION_SPOOL_PATH "/home/alex/CLionProjects/ClientServerApp/Server/sessions.spool"
 #endif
 
 #include "../../../SQLite/Lib/inc/sqlite3.h"
+#include "../../../SQLite/Lib/inc/statement_cache.h"
+#include "../../../SQLite/Lib/inc/database_profile.h"
+#include "../../../SQLite/Lib/inc/session_schema.h"
+#include "../../../SQLite/Lib/inc/connection_manager.h"
 #include "../../../TCP/inc/header.h"
+#include "../../../TCP/inc/schema.h"
 
 class ServerKeepAliveConfig {
 public:
@@ -62,6 +80,129 @@ private:
     KeepAliveProperty_t count_;
 };
 
+typedef uint32_t UserId_t;
+constexpr UserId_t kInvalidUserId = UINT32_MAX;
+
+// Maps usernames to dense ids once at auth time. Names are stored in a deque, so references
+// handed out by GetName stay valid for the lifetime of the table.
+class UserNameTable {
+public:
+    static constexpr size_t kMaxNames = 1 << 20;
+
+    // Returns kInvalidUserId for a new name once the table holds kMaxNames.
+    UserId_t Intern(std::string_view name);
+    [[nodiscard]] UserId_t Find(std::string_view name) const;
+    [[nodiscard]] const std::string& GetName(UserId_t id) const;
+    [[nodiscard]] size_t Size() const;
+
+    // Appends the names of ids as [u16 length][name], in the order given.
+    void Encode(const std::vector<UserId_t>& ids, DataBuffer_t& out) const;
+    // Interns the encoded names; ids[i] receives the id now used for the i-th encoded name.
+    bool Decode(const uint8_t* data, size_t size, uint32_t count, std::vector<UserId_t>& ids);
+
+private:
+    mutable std::shared_mutex m_mutex_;
+    std::unordered_map<std::string_view, UserId_t> m_ids_;
+    std::deque<std::string> m_names_;
+};
+
+enum class RateLimitAction : uint8_t {
+    Delay       = 0,
+    Drop        = 1,
+    Disconnect  = 2
+};
+
+constexpr size_t kRateLimitActionCount = 3;
+
+struct RateLimit {
+    uint32_t framesPerSecond = 0;
+    uint32_t burst = 0;
+
+    [[nodiscard]] bool Enabled() const {return framesPerSecond != 0;};
+    [[nodiscard]] int64_t Interval() const {return 1000000 / framesPerSecond;};
+    [[nodiscard]] int64_t Tolerance() const {return Interval() * (std::max<uint32_t>(burst, 1) - 1);};
+};
+
+// Limits applied to every frame read from a client. The user bucket is shared by all connections
+// of one login, the host bucket by all connections from one address; a zero rate disables either.
+struct RateLimitConfig {
+    RateLimit perUser;
+    RateLimit perHost;
+    RateLimitAction action = RateLimitAction::Delay;
+
+    [[nodiscard]] bool Enabled() const {return perUser.Enabled() || perHost.Enabled();};
+};
+
+// Token bucket in GCRA form: a single atomic holding the time, in microseconds, at which the
+// bucket is full again. A frame conforms while that time is at most burst - 1 intervals ahead.
+class TokenBucket {
+public:
+    [[nodiscard]] bool Ready(const RateLimit& limit, int64_t now) const {
+        return m_fullAt_.load(std::memory_order_relaxed) - now <= limit.Tolerance();
+    }
+    // Charges one frame whether or not it conforms; callers check Ready first.
+    void Consume(const RateLimit& limit, int64_t now);
+
+private:
+    std::atomic<int64_t> m_fullAt_ = 0;
+};
+
+// Buckets keyed by user id and by host. Entries live as long as the limiter, so sessions can keep
+// plain pointers to them; like the name table, the set only grows with distinct users and hosts.
+class RateLimiter {
+public:
+    static constexpr size_t kShardCount = 16;
+
+    TokenBucket* GetUserBucket(UserId_t userId) {return GetBucket(m_users_, userId);};
+    TokenBucket* GetHostBucket(uint32_t host) {return GetBucket(m_hosts_, host);};
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, TokenBucket> buckets;
+    };
+    using Shards = std::array<Shard, kShardCount>;
+
+    static TokenBucket* GetBucket(Shards& shards, uint32_t key);
+
+    Shards m_users_;
+    Shards m_hosts_;
+};
+
+enum class AdmissionLimit : uint8_t {
+    Connections      = 0,
+    HostConnections  = 1,
+    UserSessions     = 2
+};
+
+constexpr size_t kAdmissionLimitCount = 3;
+
+// Caps checked before a connection or a login is accepted; zero means unlimited. Connection caps
+// are enforced right after accept, before any session object exists, the user cap at auth.
+// A refused peer gets an Error frame with ProtocolError::AdmissionRejected.
+struct AdmissionConfig {
+    uint32_t maxConnections = 0;
+    uint32_t maxConnectionsPerHost = 0;
+    uint32_t maxSessionsPerUser = 0;
+};
+
+// Where the session writer puts finished sessions. Null keeps nothing and is meant for measuring
+// the network path on its own.
+enum class SessionSinkType : uint8_t {
+    Sqlite      = 0,
+    BinaryLog   = 1,
+    Null        = 2,
+    Journal     = 3
+};
+
+struct SessionSinkConfig {
+    SessionSinkType type = SessionSinkType::Sqlite;
+    std::string logPath = SESSION_LOG_PATH;
+    std::string journalPath = SESSION_JOURNAL_PATH;
+    // fsync the binary log, or msync the journal segment, after every committed batch.
+    bool syncLog = true;
+};
+
 class Database;
 
 class Server {
@@ -75,19 +216,24 @@ public:
         [[nodiscard]] uint32_t GetHost() const override;
         [[nodiscard]] uint16_t GetPort() const override;
         [[nodiscard]] SockStatusInfo_t GetStatus() const override {return m_connectionStatus_;};
-        [[nodiscard]] std::string GetUserNameIn() const {return username_;};
+        [[nodiscard]] std::string GetUserNameIn() const {return m_userName_ ? *m_userName_ : std::string();};
+        [[nodiscard]] UserId_t GetUserId() const {return m_userId_;};
 
         SockStatusInfo_t Disconnect() override;
 
         DataBuffer_t LoadData() override;
+        Frame LoadFrame(const FrameLimits& limits, bool as_view = false);
         bool SendData(const void* buffer, size_t size) const override;
+        bool SendFrame(FrameType type, const void* buffer, size_t size) const;
+        bool SendEncodedFrame(const DataBuffer_t& frame, std::chrono::milliseconds timeout = kSocketIoTimeout) const;
+        void RejectFrame(ProtocolError error);
         bool AutentficateUserInfo(const DataBuffer_t& data,Server::InterfaceClientSession& client, Server& server);
         [[nodiscard]] ConnectionType GetType() const override {return ConnectionType::Server;}
 
         [[nodiscard]] std::chrono::system_clock::time_point GetFirstConnectionTime() const { return m_firstConnectionTime_; }
         [[nodiscard]] std::chrono::system_clock::time_point GetLastDisconnectionTime() const { return m_lastDisconnectionTime_; }
 
-        static std::string ConnectionTimes(const InterfaceClientSession& client, Server& server);
+        static uint32_t ConnectionDuration(const InterfaceClientSession& client);
         void OnDisconnect(const InterfaceClientSession& client, Server& server);
 
         std::string GetDayNow();
@@ -107,42 +253,565 @@ public:
         std::chrono::system_clock::time_point m_lastDisconnectionTime_;
 
 
-        void SetFirstConnectionTime() { m_firstConnectionTime_ = std::chrono::system_clock::now(); }
-        void SetLastDisconnectionTime() { m_lastDisconnectionTime_ = std::chrono::system_clock::now(); }
-
-        std::string username_;
+        static std::chrono::system_clock::time_point CoarseNow() {
+            return std::chrono::system_clock::time_point(std::chrono::milliseconds(CoarseClock::Instance().NowMilliseconds()));
+        }
+        void SetFirstConnectionTime() { m_firstConnectionTime_ = CoarseNow(); }
+        void SetLastDisconnectionTime() { m_lastDisconnectionTime_ = CoarseNow(); }
+
+        DataView ReceiveView(size_t size);
+        bool PushStreamChunk(StreamChunk chunk);
+        bool PopStreamChunk(StreamChunk& chunk);
+        void ReleaseStreamWindow(uint32_t stream_id, uint32_t credit);
+
+        bool RateLimitReady(const RateLimitConfig& config, int64_t now) const;
+        // Charges the host and user buckets only when both have room.
+        bool ConsumeRateLimit(const RateLimitConfig& config, int64_t now);
+        void ChargeRateLimit(const RateLimitConfig& config, int64_t now);
+
+        UserId_t m_userId_ = kInvalidUserId;
+        const std::string* m_userName_ = nullptr;
+        TokenBucket* m_hostBucket_ = nullptr;
+        std::atomic<TokenBucket*> m_userBucket_ = nullptr;
+        // Set while a frame waits in the socket for the buckets, so it is counted as delayed once.
+        bool m_rateDelayed_ = false;
+
+        mutable std::mutex m_sendMutex_;
+        std::vector<UserId_t> m_presenceSubscriptions_;
+
+        // Presence frames wait here until a pool task sends them, so publishing never writes to a
+        // socket. A subscriber that cannot take a frame within kPresenceSendTimeout is disconnected.
+        static constexpr size_t kMaxPresenceQueue = 64;
+        static constexpr std::chrono::milliseconds kPresenceSendTimeout{100};
+        bool QueuePresence(std::shared_ptr<const DataBuffer_t> frame);
+        void SendQueuedPresence();
+        std::mutex m_presenceMutex_;
+        std::deque<std::shared_ptr<const DataBuffer_t>> m_presenceQueue_;
+        // Set when frames were queued and no send task has been scheduled for them yet.
+        std::atomic<bool> m_presencePending_ = false;
+        // Send tasks queued and not finished; the session is not torn down while any remain.
+        std::atomic<uint32_t> m_presenceTasks_ = 0;
+        // Set by the data loop once it has queued the disconnect task.
+        bool m_closing_ = false;
+
+        // Reused for every view-mode frame. The deleter of the lease handed to the view clears
+        // leased_, so a buffer still held by a handler is replaced instead of overwritten.
+        struct ReceiveBuffer {
+            DataBuffer_t data;
+            std::atomic<bool> leased_ = false;
+
+            ~ReceiveBuffer() {BufferPool::Instance().Release(std::move(data));}
+        };
+        std::shared_ptr<ReceiveBuffer> m_receiveBuffer_;
+
+        // Per-stream credit the peer may still send; chunks wait here until a handler task takes them.
+        // A session has at most kMaxStreams open, so it holds at most kMaxStreams windows of data.
+        static constexpr size_t kMaxStreams = 8;
+        std::mutex m_streamMutex_;
+        std::deque<StreamChunk> m_pendingChunks_;
+        std::unordered_map<uint32_t, uint32_t> m_streamWindows_;
 
     };
 
+    // Session record kept in memory; times are epoch seconds and only turned into text when printed or persisted.
     struct UserInfo {
-        std::string username_;
+        UserId_t userId_ = kInvalidUserId;
+        uint16_t sessionPort_ = 0;
+        uint32_t duration_ = 0;
+        int64_t connectTime_ = 0;
+        int64_t disconnectTime_ = 0;
+        // The password presented by the login that opened this session.
         std::string password_;
-        uint16_t sessionPort_;
-        std::string connectTime_;
-        std::string disconnectTime_;
-        std::string duration_;
-        std::string timeToday_;
 
-        explicit UserInfo(std::string username,
-                          std::string pass,
+        UserInfo() = default;
+        explicit UserInfo(UserId_t userId,
                           uint16_t port,
-                          std::string connectTime,
-                          std::string disconnectTime,
-                          std::string duration,
-                          std::string timeToday);
+                          int64_t connectTime,
+                          int64_t disconnectTime = 0,
+                          uint32_t duration = 0);
+    };
+
+    using UserInfoSchema = MessageSchema<UserInfo,
+            SchemaField<&UserInfo::sessionPort_>,
+            SchemaField<&UserInfo::duration_>,
+            SchemaField<&UserInfo::connectTime_>,
+            SchemaField<&UserInfo::disconnectTime_>,
+            SchemaField<&UserInfo::userId_>,
+            SchemaField<&UserInfo::password_>>;
+
+    // Sessions that are currently open, split over shards by user id, so logins of different users
+    // rarely touch the same lock. Reporting copies one shard at a time and prints without locks.
+    class UserRegistry {
+    public:
+        static constexpr size_t kShardCount = 16;
+        using Snapshot = std::vector<std::pair<UserId_t, std::vector<UserInfo>>>;
+
+        bool AddSession(const UserInfo& userInfo);
+        bool CloseSession(UserId_t userId, uint16_t port, int64_t disconnectTime, UserInfo& closed);
+        void EraseUser(UserId_t userId);
+        [[nodiscard]] Snapshot TakeSnapshot() const;
+        // Bumped by every change to the open sessions, so the snapshot writer can tell when nothing moved.
+        [[nodiscard]] uint64_t GetChangeCount() const {return m_changes_.load(std::memory_order_acquire);};
+
+    private:
+        struct alignas(64) Shard {
+            mutable std::mutex mutex;
+            std::unordered_map<UserId_t, std::vector<UserInfo>> users;
+        };
+
+        Shard& GetShard(UserId_t userId) {
+            return m_shards_[userId % kShardCount];
+        }
+
+        std::array<Shard, kShardCount> m_shards_;
+        std::atomic<uint64_t> m_changes_ = 0;
     };
 
+    // Live connection and session counts, kept current on accept, auth and disconnect so that
+    // polling them never walks the session list or the registry.
+    class SessionCounters {
+    public:
+        static constexpr size_t kShardCount = 16;
+
+        void OnConnect(uint32_t host);
+        void OnDisconnect(uint32_t host);
+        bool OnAuth(UserId_t userId, uint32_t limit = 0);
+        void OnSessionClose(UserId_t userId);
+        void Reset();
+
+        [[nodiscard]] uint64_t GetConnectionCount() const {return m_connections_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetSessionCount() const {return m_sessions_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint32_t GetUserSessionCount(UserId_t userId) const {return Get(m_users_, userId);};
+        [[nodiscard]] uint32_t GetHostConnectionCount(uint32_t host) const {return Get(m_hosts_, host);};
+
+    private:
+        struct alignas(64) Shard {
+            mutable std::mutex mutex;
+            std::unordered_map<uint32_t, uint32_t> counts;
+        };
+        using Shards = std::array<Shard, kShardCount>;
+
+        template<typename ShardArray>
+        static auto& GetShard(ShardArray& shards, uint32_t key) {return shards[(key * 0x9E3779B1u) >> 28];};
+        static uint32_t Get(const Shards& shards, uint32_t key);
+        static uint32_t Increment(Shards& shards, uint32_t key, uint32_t limit = 0);
+        static uint32_t Decrement(Shards& shards, uint32_t key);
+
+        std::atomic<uint64_t> m_connections_ = 0;
+        std::atomic<uint64_t> m_sessions_ = 0;
+        Shards m_users_;
+        Shards m_hosts_;
+    };
+
+    // Sessions watching other users' online state. Changes are held for a short window and only
+    // published if the state at the end differs from the last one sent, so quick reconnects never
+    // reach subscribers. Each update is encoded once and the same bytes are queued on every subscriber.
+    class PresenceService {
+    public:
+        static constexpr int64_t kDefaultCoalesceWindow = 250;
+
+        PresenceState Subscribe(InterfaceClientSession& subscriber, UserId_t userId, PresenceState current);
+        void Unsubscribe(InterfaceClientSession& subscriber, UserId_t userId);
+        void RemoveSubscriber(InterfaceClientSession& subscriber);
+        void MarkChanged(UserId_t userId, int64_t now);
+        size_t Flush(int64_t now, const SessionCounters& counters, const UserNameTable& names);
+
+        void SetCoalesceWindow(int64_t milliseconds) {m_window_ = milliseconds;};
+        [[nodiscard]] uint64_t GetPublishedCount() const {return m_publishedCount_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetSuppressedCount() const {return m_suppressedCount_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetDroppedCount() const {return m_droppedCount_.load(std::memory_order_relaxed);};
+
+    private:
+        std::mutex m_mutex_;
+        std::unordered_map<UserId_t, std::vector<InterfaceClientSession*>> m_subscribers_;
+        std::unordered_map<UserId_t, PresenceState> m_published_;
+        std::unordered_map<UserId_t, int64_t> m_pending_;
+        std::atomic<int64_t> m_nextFlush_ = INT64_MAX;
+        int64_t m_window_ = kDefaultCoalesceWindow;
+
+        std::atomic<uint64_t> m_publishedCount_ = 0;
+        std::atomic<uint64_t> m_suppressedCount_ = 0;
+        std::atomic<uint64_t> m_droppedCount_ = 0;
+    };
+
+    // Connect and Auth are not pushed: the writer only persists finished sessions, so the ring
+    // carries Disconnect events alone.
+    enum class SessionEventType : uint8_t {
+        Connect     = 0,
+        Auth        = 1,
+        Disconnect  = 2
+    };
+
+    struct SessionEvent {
+        SessionEventType type_ = SessionEventType::Connect;
+        uint32_t host_ = 0;
+        UserInfo session_;
+    };
+
+    // Flat image of the open sessions and the names of their users; passwords are not kept. The file
+    // holds two slots written in turn, so a crash in the middle of a write still leaves the previous
+    // image readable. While the sessions do not change only the header is rewritten, to move takenAt_.
+    struct SnapshotHeader {
+        static constexpr uint32_t kMagic = 0x53534353; // "SCSS"
+        static constexpr uint32_t kVersion = 2;
+        // Two times, the duration, the port and two strings of at most UINT16_MAX bytes.
+        static constexpr uint32_t kMaxRecordSize = 2 * sizeof(int64_t) + sizeof(uint32_t) + sizeof(uint16_t)
+                                                   + 2 * (sizeof(uint16_t) + UINT16_MAX);
+
+        uint32_t magic_;
+        uint32_t version_;
+        uint64_t sequence_;
+        int64_t takenAt_;
+        uint32_t sessionCount_;
+        uint32_t nameCount_;
+        uint64_t bodySize_;
+        uint64_t checksum_;
+    };
+
+    struct SnapshotSession {
+        UserId_t userId_;
+        uint16_t sessionPort_;
+        uint16_t reserved_;
+        int64_t connectTime_;
+    };
+
+    static constexpr size_t kSnapshotMinSlotSize = 64 * 1024;
+    static constexpr std::chrono::seconds kSnapshotInterval{1};
+
+    // The session writer commits finished sessions in one transaction per batch, either when this
+    // many are queued or when the window has passed since it last ran.
+    static constexpr size_t kWriterBatchSize = 512;
+    static constexpr std::chrono::milliseconds kWriterWindow{100};
+
+    // Spaces out retries of a failing background step: the wait doubles after every failure up to
+    // kMaxDelay milliseconds, and a success clears it.
+    struct RetryBackoff {
+        static constexpr int64_t kFirstDelay = 100;
+        static constexpr int64_t kMaxDelay = 60000;
+
+        [[nodiscard]] bool Ready(int64_t now) const {return now >= retryAt_;};
+        int64_t Fail(int64_t now) {
+            delay_ = delay_ ? std::min(delay_ * 2, kMaxDelay) : kFirstDelay;
+            retryAt_ = now + delay_;
+            return delay_;
+        };
+        void Succeed() {retryAt_ = 0; delay_ = 0;};
+
+        int64_t retryAt_ = 0;
+        int64_t delay_ = 0;
+    };
+
+    // Only the session writer calls into a sink, one batch at a time: Begin, Write for each
+    // session, Commit.
+    class SessionSink {
+    public:
+        virtual ~SessionSink() = default;
+
+        [[nodiscard]] virtual const char* GetName() const = 0;
+        virtual bool Begin() {return true;};
+        virtual bool Write(const UserInfo& session, const UserNameTable& names) = 0;
+        virtual bool Commit() {return true;};
+        // Background work between batches.
+        virtual void Maintain() {};
+        // Called when the writer stops; everything committed so far must be on disk afterwards.
+        virtual void Sync() {};
+        virtual void PrintStats() const {};
+    };
+
+    class SqliteSessionSink : public SessionSink {
+    public:
+        explicit SqliteSessionSink(ConnectionManager& database);
+
+        [[nodiscard]] const char* GetName() const override {return "sqlite";};
+        bool Begin() override;
+        bool Write(const UserInfo& session, const UserNameTable& names) override;
+        bool Commit() override;
+        void Maintain() override;
+        void Sync() override;
+        void PrintStats() const override;
+
+    private:
+        sqlite3* m_connection_;
+        StatementCache& m_statements_;
+        SessionPartitions m_partitions_;
+        int m_retentionDays_;
+        int64_t m_rotatedDay_ = 0;
+        bool m_migrationPending_ = false;
+        RetryBackoff m_migrationRetry_;
+        std::atomic<uint64_t> m_migratedSessions_ = 0;
+    };
+
+    struct SessionLogRecord {
+        int64_t connectTime_ = 0;
+        int64_t disconnectTime_ = 0;
+        uint32_t duration_ = 0;
+        uint16_t sessionPort_ = 0;
+        std::string user_;
+        std::string password_;
+    };
+
+    using SessionLogRecordSchema = MessageSchema<SessionLogRecord,
+            SchemaField<&SessionLogRecord::connectTime_>,
+            SchemaField<&SessionLogRecord::disconnectTime_>,
+            SchemaField<&SessionLogRecord::duration_>,
+            SchemaField<&SessionLogRecord::sessionPort_>,
+            SchemaField<&SessionLogRecord::user_>,
+            SchemaField<&SessionLogRecord::password_>>;
+
+    // Append-only file: an 8-byte header (magic "SCSL", version), then one uint32 length and one
+    // SessionLogRecord per session. A batch is buffered and written with a single write; a torn
+    // tail after a crash ends the replay.
+    class BinaryLogSessionSink : public SessionSink {
+    public:
+        static constexpr uint32_t kMagic = 0x4C534353;
+        static constexpr uint32_t kVersion = 2;
+        // Two times, the duration, the port and two strings of at most UINT16_MAX bytes.
+        static constexpr uint32_t kMaxRecordSize = 2 * sizeof(int64_t) + sizeof(uint32_t) + sizeof(uint16_t)
+                                                   + 2 * (sizeof(uint16_t) + UINT16_MAX);
+
+        BinaryLogSessionSink(std::string path, bool sync);
+        ~BinaryLogSessionSink() override;
+
+        [[nodiscard]] const char* GetName() const override {return "binlog";};
+        bool Write(const UserInfo& session, const UserNameTable& names) override;
+        bool Commit() override;
+        void Sync() override;
+        void PrintStats() const override;
+
+        static size_t Replay(const std::string& path, const std::function<void(const SessionLogRecord&)>& handler);
+
+    private:
+        static bool ReadRecord(std::FILE* file, DataBuffer_t& payload, SessionLogRecord& record);
+
+        std::string m_path_;
+        std::FILE* m_file_ = nullptr;
+        bool m_sync_;
+        DataBuffer_t m_batch_;
+        SessionLogRecord m_record_;
+        std::atomic<uint64_t> m_writtenBytes_ = 0;
+    };
+
+    enum class JournalRecordType : uint8_t {
+        Empty   = 0,
+        Session = 1,
+        Name    = 2
+    };
+
+    // One 64-byte journal slot. A session takes one slot. A name record maps a user id to its name
+    // for the rest of the segment; names longer than name_ run on into the following slots. The
+    // checksum covers the record after itself including those slots, and sequence_ counts records
+    // from zero in every segment, so the scan stops at the first torn or never-written slot.
+    struct JournalRecord {
+        uint32_t checksum_;
+        JournalRecordType type_;
+        uint8_t reserved_;
+        uint16_t sessionPort_;
+        UserId_t userId_;
+        uint32_t duration_;         // name records: length of the name
+        uint64_t sequence_;
+        int64_t connectTime_;
+        int64_t disconnectTime_;
+        char name_[24];
+    };
+
+    struct JournalSegmentHeader {
+        uint32_t magic_;
+        uint32_t version_;
+        uint64_t segment_;
+        int64_t createdAt_;
+        uint8_t reserved_[40];
+    };
+
+    static_assert(sizeof(JournalRecord) == 64 && sizeof(JournalSegmentHeader) == sizeof(JournalRecord));
+
+    // Appends sessions to preallocated, memory-mapped segment files; an append is a memcpy into
+    // the mapping. A segment is sealed when full or older than kSegmentMaxAge, and a background
+    // thread then copies it into SQLite and deletes it. Segments left over from a previous run
+    // are scanned up to their last valid record and compacted the same way. Compacted segment
+    // ids are recorded in the same transaction as their rows, so a segment is never imported twice.
+    class JournalSessionSink : public SessionSink {
+    public:
+        static constexpr uint32_t kMagic = 0x4A534353;
+        static constexpr uint32_t kVersion = 1;
+        static constexpr size_t kSegmentSize = 4 * 1024 * 1024;
+        static constexpr std::chrono::seconds kSegmentMaxAge{60};
+
+        using Visitor = std::function<void(const JournalRecord& record, std::string_view name)>;
+
+        JournalSessionSink(std::string directory, bool sync, ConnectionManager& database);
+        ~JournalSessionSink() override;
+
+        [[nodiscard]] const char* GetName() const override {return "journal";};
+        bool Write(const UserInfo& session, const UserNameTable& names) override;
+        bool Commit() override;
+        void Maintain() override;
+        void Sync() override;
+        void PrintStats() const override;
+
+        // Visits the valid records of a segment in order; returns how many there were.
+        static size_t ScanSegment(const uint8_t* data, size_t size, const Visitor& visitor);
+
+    private:
+        [[nodiscard]] std::string GetSegmentPath(uint64_t segment) const;
+        bool OpenSegment(uint64_t segment);
+        void SealSegment();
+        void Append(JournalRecord& record, const std::string& name = {});
+        void CompactorLoop();
+        bool CompactSegment(uint64_t segment);
+
+        std::string m_directory_;
+        bool m_sync_;
+
+        MappedFile m_segment_;
+        uint64_t m_segmentId_ = 0;
+        int64_t m_segmentOpenedAt_ = 0;
+        size_t m_position_ = 0;
+        uint64_t m_sequence_ = 0;
+        std::unordered_set<UserId_t> m_namedUsers_;
+
+        sqlite3* m_connection_;
+        StatementCache& m_statements_;
+        SessionPartitions m_partitions_;
+        int m_retentionDays_;
+        int64_t m_rotatedDay_ = 0;
+        bool m_migrationPending_ = false;
+        RetryBackoff m_migrationRetry_;
+        std::thread m_compactorThread_;
+        std::mutex m_compactorMutex_;
+        std::condition_variable m_compactorCondition_;
+        std::deque<uint64_t> m_sealedSegments_;
+        bool m_compactorRunning_ = true;
+
+        std::atomic<uint64_t> m_appendedSessions_ = 0;
+        std::atomic<uint64_t> m_compactedSessions_ = 0;
+        std::atomic<uint64_t> m_compactedSegments_ = 0;
+    };
+
+    class NullSessionSink : public SessionSink {
+    public:
+        [[nodiscard]] const char* GetName() const override {return "null";};
+        bool Write(const UserInfo&, const UserNameTable&) override {return true;};
+    };
+
+    // Overflow of the session log. When the ring is full because the sink is slow, finished
+    // sessions are appended here instead of blocking the network thread or being dropped, and the
+    // writer reads them back once the ring is empty. The file is truncated whenever it has been
+    // read completely; one left over from a previous run is counted by Open and drained when the
+    // writer starts.
+    class SessionSpool {
+    public:
+        // Encoded sessions a producer collects in memory before it writes them to the file.
+        static constexpr size_t kAppendBufferSize = 64 * 1024;
+
+        ~SessionSpool();
+
+        void SetPath(std::string path);
+        bool Open();
+        bool Append(const SessionLogRecord& record);
+        // Replaces records with up to limit spooled sessions; returns how many were read.
+        size_t Read(std::vector<SessionLogRecord>& records, size_t limit);
+
+        [[nodiscard]] uint64_t GetPendingCount() const {return m_pending_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetSpilledCount() const {return m_spilled_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetSpilledBytes() const {return m_spilledBytes_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetDrainedCount() const {return m_drained_.load(std::memory_order_relaxed);};
+        [[nodiscard]] uint64_t GetLostCount() const {return m_lost_.load(std::memory_order_relaxed);};
+
+    private:
+        bool OpenLocked();
+        void ResetLocked();
+        void FlushAppended();
+        void WriteOut(const DataBuffer_t& buffer, uint64_t records);
+
+        // Producers only take m_mutex_ to encode into m_appended_; the file and its offsets are
+        // guarded by m_fileMutex_, so reads of the writer never hold up a producer.
+        std::mutex m_mutex_;
+        DataBuffer_t m_appended_;
+        uint64_t m_appendedCount_ = 0;
+
+        std::mutex m_fileMutex_;
+        std::string m_path_ = SESSION_SPOOL_PATH;
+        std::FILE* m_file_ = nullptr;
+        long m_readOffset_ = 0;
+        long m_writeOffset_ = 0;
+        uint64_t m_filePending_ = 0;
+        DataBuffer_t m_buffer_;
+
+        // Sessions not read back yet, in the file and in m_appended_.
+        std::atomic<uint64_t> m_pending_ = 0;
+        std::atomic<uint64_t> m_spilled_ = 0;
+        std::atomic<uint64_t> m_spilledBytes_ = 0;
+        std::atomic<uint64_t> m_drained_ = 0;
+        std::atomic<uint64_t> m_lost_ = 0;
+    };
+
+    // SQLite backed sinks take the writer connection of database.
+    static std::unique_ptr<SessionSink> MakeSessionSink(const SessionSinkConfig& config, ConnectionManager& database);
+
+    // Bounded multi-producer/multi-consumer ring of session events (Vyukov's sequence-per-cell
+    // queue). Producers never block: a full log refuses the event, and PushSessionEvent spills
+    // a refused session to the spool.
+    class SessionLog {
+    public:
+        static constexpr size_t kDefaultCapacity = 1 << 16;
+
+        explicit SessionLog(size_t capacity = kDefaultCapacity);
+
+        bool Push(const SessionEvent& event);
+        bool Pop(SessionEvent& event);
+
+        [[nodiscard]] size_t GetCapacity() const {return m_mask_ + 1;};
+        [[nodiscard]] size_t GetSize() const;
+        [[nodiscard]] uint64_t GetOverflowCount() const {return m_overflows_.load(std::memory_order_relaxed);};
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            SessionEvent event;
+        };
+
+        std::unique_ptr<Cell[]> m_cells_;
+        size_t m_mask_;
+        alignas(64) std::atomic<size_t> m_enqueuePosition_ = 0;
+        alignas(64) std::atomic<size_t> m_dequeuePosition_ = 0;
+        std::atomic<uint64_t> m_overflows_ = 0;
+    };
+
+    static std::string FormatDate(int64_t epoch);
+    static std::string FormatDateTime(int64_t epoch);
+    static std::string FormatDuration(uint32_t duration);
+
     void printUserInfo(const UserInfo& userInfo);
     void printAllUsersInfo();
-    void initializeDatabase();
-    void writeToDatabase(const UserInfo& userInfo);
+    void printBufferPoolStats();
+    void printFrameStats();
+    void printSessionCounts(const std::string& username = "");
+    void printRateLimitStats();
+    void printAdmissionStats();
+    void printWriterStats();
+    void printDatabaseStats();
+    // Answered from a pooled read connection, so pool threads can run queries side by side.
+    bool QueryUserTime(const std::string& username, int64_t day, int64_t& seconds);
     void clearUser(const std::string& username);
-
-    using DataHandleFunctionServer = std::function<void(DataBuffer_t , InterfaceClientSession&)>;
+    size_t FlushSessionLog();
+    void WakeSessionWriter();
+    void PushSessionEvent(SessionEventType type, uint32_t host, const UserInfo& session);
+    bool WriteSnapshot();
+    size_t RestoreSnapshot();
+
+    // The buffer goes back to the pool when the handler returns; move out of it to keep the bytes.
+    using DataHandleFunctionServer = std::function<void(DataBuffer_t&, InterfaceClientSession&)>;
     using ConnectionHandlerFunction = std::function<void(InterfaceClientSession&)>;
+    using StreamHandleFunctionServer = std::function<void(const StreamChunk&, InterfaceClientSession&)>;
+    using ViewHandleFunctionServer = std::function<void(const DataView&, InterfaceClientSession&)>;
+    using TelemetryHandleFunctionServer = std::function<void(const PcDataRecord&, InterfaceClientSession&)>;
 
     static constexpr auto kDefaultDataHandlerServer
         = [](const DataBuffer_t&, InterfaceClientSession&){};
+    static constexpr auto kDefaultStreamHandlerServer
+        = [](const StreamChunk&, InterfaceClientSession&){};
+    static constexpr auto kDefaultTelemetryHandlerServer
+        = [](const PcDataRecord&, InterfaceClientSession&){};
     static constexpr auto kDefaultConnectionHandlerServer
         = [](InterfaceClientSession&){};
 
@@ -151,13 +820,23 @@ public:
            DataHandleFunctionServer handler             = kDefaultDataHandlerServer,
            ConnectionHandlerFunction connect_handle     = kDefaultConnectionHandlerServer,
            ConnectionHandlerFunction disconnect_handle  = kDefaultConnectionHandlerServer,
-           uint32_t thread_count                        = HARDWARE_CONCURRENCY
+           uint32_t thread_count                        = HARDWARE_CONCURRENCY,
+           DatabaseConfig database_config               = {},
+           SessionSinkConfig sink_config                = {}
     );
 
     ~Server();
 
     //setter
     void SetServerDataHandler(DataHandleFunctionServer handler);
+    void SetServerStreamHandler(StreamHandleFunctionServer handler);
+    void SetServerViewHandler(ViewHandleFunctionServer handler);
+    void SetServerTelemetryHandler(TelemetryHandleFunctionServer handler);
+    void SetFrameLimits(const FrameLimits& limits) {m_frameLimits_ = limits;};
+    void SetRateLimits(const RateLimitConfig& config) {m_rateLimits_ = config;};
+    void SetAdmission(const AdmissionConfig& config) {m_admission_ = config;};
+    void SetSnapshotPath(std::string path) {m_snapshotPath_ = std::move(path);};
+    void SetSpoolPath(std::string path) {m_spool_.SetPath(std::move(path));};
     uint16_t SetServerPort(uint16_t port);
 
 
@@ -165,10 +844,34 @@ public:
     NetworkThreadPool& GetThreadExecutor() {return m_threadPoolServer_;};
     [[nodiscard]] SocketStatusInfo GetServerStatus() const {return m_serverStatus_;}
     [[nodiscard]] uint16_t GetServerPort() const {return port_;};
-    std::mutex& getUsersMutex() {return usersMutex;}
-    const std::unordered_map<std::string, std::vector<UserInfo>>& getUsers() const {
-        return users;
+    [[nodiscard]] const FrameLimits& GetFrameLimits() const {return m_frameLimits_;};
+    [[nodiscard]] const RateLimitConfig& GetRateLimits() const {return m_rateLimits_;};
+    [[nodiscard]] const AdmissionConfig& GetAdmission() const {return m_admission_;};
+    [[nodiscard]] const DatabaseConfig& GetDatabaseConfig() const {return m_databaseConfig_;};
+    [[nodiscard]] const SessionSinkConfig& GetSessionSinkConfig() const {return m_sinkConfig_;};
+    [[nodiscard]] const SessionSink& GetSessionSink() const {return *m_sink_;};
+    ConnectionManager& GetDatabase() {return m_database_;};
+    [[nodiscard]] uint64_t GetAdmissionRejectedCount(AdmissionLimit limit) const {
+        return m_admissionRejected_[static_cast<size_t>(limit)].load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] uint64_t GetRateLimitedCount(RateLimitAction action) const {
+        return m_rateLimited_[static_cast<size_t>(action)].load(std::memory_order_relaxed);
     }
+    [[nodiscard]] uint64_t GetRejectedFrameCount(ProtocolError error) const {
+        return m_rejectedFrames_[static_cast<size_t>(error)].load(std::memory_order_relaxed);
+    }
+    UserRegistry& GetUserRegistry() {return m_users_;};
+    UserNameTable& GetUserNames() {return m_userNames_;};
+    SessionLog& GetSessionLog() {return m_sessionLog_;};
+    [[nodiscard]] const SessionSpool& GetSessionSpool() const {return m_spool_;};
+    [[nodiscard]] size_t GetSessionQueuePeak() const {return m_sessionQueuePeak_.load(std::memory_order_relaxed);};
+    [[nodiscard]] uint64_t GetDroppedSessionCount() const {return m_droppedSessions_.load(std::memory_order_relaxed);};
+    PresenceService& GetPresence() {return m_presence_;};
+    [[nodiscard]] uint64_t GetConnectionCount() const {return m_counters_.GetConnectionCount();};
+    [[nodiscard]] uint64_t GetSessionCount() const {return m_counters_.GetSessionCount();};
+    [[nodiscard]] uint32_t GetUserSessionCount(UserId_t userId) const {return m_counters_.GetUserSessionCount(userId);};
+    [[nodiscard]] uint32_t GetUserSessionCount(std::string_view username) const;
+    [[nodiscard]] uint32_t GetHostConnectionCount(uint32_t host) const {return m_counters_.GetHostConnectionCount(host);};
 
     SocketStatusInfo StartServer();
 
@@ -182,19 +885,70 @@ public:
     void ServerDisconnectAll();
 
 private:
-    std::unordered_map<std::string, std::vector<UserInfo>> users;
-    std::mutex usersMutex;
+    UserNameTable m_userNames_;
+    UserRegistry m_users_;
+    SessionLog m_sessionLog_;
+    SessionCounters m_counters_;
+    PresenceService m_presence_;
+
+    std::string m_snapshotPath_ = SNAPSHOT_PATH;
+    MappedFile m_snapshotFile_;
+    std::mutex m_snapshotWriteMutex_;
+    uint64_t m_snapshotSequence_ = 0;
+    // Registry change count m_snapshotBuffer_ was built at, and how many slots hold that body.
+    uint64_t m_snapshotChanges_ = UINT64_MAX;
+    size_t m_snapshotCurrentSlots_ = 0;
+    uint32_t m_snapshotSessionCount_ = 0;
+    uint32_t m_snapshotNameCount_ = 0;
+    DataBuffer_t m_snapshotBuffer_;
+    std::thread m_snapshotThread_;
+    std::mutex m_snapshotMutex_;
+    std::condition_variable m_snapshotCondition_;
+    bool m_snapshotRunning_ = false;
+
+    std::unique_ptr<SessionSink> m_sink_;
+    std::mutex m_sinkMutex_;
+    SessionSpool m_spool_;
+    std::vector<SessionLogRecord> m_spoolBatch_;
+    // Sessions of the open batch, spilled to the spool if its commit fails.
+    std::vector<UserInfo> m_writerBatch_;
+    std::atomic<size_t> m_sessionQueuePeak_ = 0;
+    std::atomic<uint64_t> m_droppedSessions_ = 0;
+    std::thread m_writerThread_;
+    std::mutex m_writerMutex_;
+    std::condition_variable m_writerCondition_;
+    bool m_writerRunning_ = false;
+    bool m_writerWakeRequested_ = false;
+    std::atomic<uint64_t> m_writtenSessions_ = 0;
+    std::atomic<uint64_t> m_writerCommits_ = 0;
+    std::atomic<uint64_t> m_failedBatches_ = 0;
 
     using ServerSessionIterator = std::list<std::unique_ptr<InterfaceClientSession>>::iterator;
     std::list<std::unique_ptr<InterfaceClientSession>> m_session_list_;
 
     DataHandleFunctionServer m_handler_ = kDefaultDataHandlerServer;
+    StreamHandleFunctionServer m_streamHandler_ = kDefaultStreamHandlerServer;
+    ViewHandleFunctionServer m_viewHandler_;
+    TelemetryHandleFunctionServer m_telemetryHandler_ = kDefaultTelemetryHandlerServer;
     ConnectionHandlerFunction m_connectHandle_ = kDefaultConnectionHandlerServer;
     ConnectionHandlerFunction m_disconnectHandle_ = kDefaultConnectionHandlerServer;
 
+    FrameLimits m_frameLimits_;
+    std::array<std::atomic<uint64_t>, kProtocolErrorCount> m_rejectedFrames_{};
+
+    RateLimitConfig m_rateLimits_;
+    RateLimiter m_rateLimiter_;
+    std::array<std::atomic<uint64_t>, kRateLimitActionCount> m_rateLimited_{};
+
+    AdmissionConfig m_admission_;
+    std::array<std::atomic<uint64_t>, kAdmissionLimitCount> m_admissionRejected_{};
+
     SocketHandle_t m_socketServer_{};
     SocketStatusInfo m_serverStatus_ = SocketStatusInfo::Disconnected;
     ServerKeepAliveConfig m_keepAliveConfig_;
+    DatabaseConfig m_databaseConfig_;
+    SessionSinkConfig m_sinkConfig_;
+    ConnectionManager m_database_;
 
     NetworkThreadPool m_threadPoolServer_;
     std::mutex m_clientMutex_;
@@ -202,8 +956,19 @@ private:
     std::uint16_t port_;
 
     bool EnableKeepAlive(SocketHandle_t socket);
+    bool AdmitConnection(SocketHandle_t socket, uint32_t host);
     void HandlingAcceptLoop();
     void WaitingDataLoop();
+    void DispatchFrame(Frame frame, std::unique_ptr<InterfaceClientSession>& client);
+    void RejectFrame(InterfaceClientSession& client, ProtocolError error);
+    void HandlePresenceSubscribe(const DataBuffer_t& payload, InterfaceClientSession& client);
+    void StartSnapshotLoop();
+    void StopSnapshotLoop();
+    void SnapshotLoop();
+    void StartSessionWriter();
+    void StopSessionWriter();
+    void SessionWriterLoop();
+    bool SpillSession(const UserInfo& session);
 };
 
 #endif //ALL_HEADER_SERVER_H
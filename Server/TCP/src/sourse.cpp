@@ -85,29 +85,42 @@ inline int convertError() {
 #define NIX(exp) exp
 #endif
 
-sqlite3* dbConnection;
+static int64_t ToEpochSeconds(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
 
 Server::Server(const uint16_t port,
                      ServerKeepAliveConfig keep_alive_config,
                      DataHandleFunctionServer handler,
                      ConnectionHandlerFunction connect_handle,
                      ConnectionHandlerFunction disconnect_handle,
-                     uint32_t thread_count
+                     uint32_t thread_count,
+                     DatabaseConfig database_config,
+                     SessionSinkConfig sink_config
 )
         : port_(port),
           m_handler_(std::move(handler)),
           m_connectHandle_(std::move(connect_handle)),
           m_disconnectHandle_(std::move(disconnect_handle)),
           m_threadPoolServer_(thread_count),
-          m_keepAliveConfig_(keep_alive_config)
+          m_keepAliveConfig_(keep_alive_config),
+          m_databaseConfig_(std::move(database_config)),
+          m_sinkConfig_(std::move(sink_config)),
+          m_database_(m_databaseConfig_)
 {
-    initializeDatabase();
+    CoarseClock::Instance().StartTicking();
+    m_database_.Open();
+    m_sink_ = MakeSessionSink(m_sinkConfig_, m_database_);
+    RestoreSnapshot();
 }
 
 Server::~Server() {
     if(m_serverStatus_ == SocketStatusInfo::Connected) {
         StopServer();
     }
+    StopSnapshotLoop();
+    StopSessionWriter();
+    m_sink_.reset();
 }
 
 void Server::StopServer() {
@@ -115,12 +128,27 @@ void Server::StopServer() {
     m_serverStatus_ = SocketStatusInfo::Disconnected;
     WIN(closesocket)NIX(close)(m_socketServer_);
     m_session_list_.clear();
+    m_counters_.Reset();
+    StopSnapshotLoop();
+    StopSessionWriter();
 }
 
 void Server::SetServerDataHandler(Server::DataHandleFunctionServer handler) {
     this->m_handler_ = std::move(handler);
 }
 
+void Server::SetServerStreamHandler(Server::StreamHandleFunctionServer handler) {
+    this->m_streamHandler_ = std::move(handler);
+}
+
+void Server::SetServerViewHandler(Server::ViewHandleFunctionServer handler) {
+    this->m_viewHandler_ = std::move(handler);
+}
+
+void Server::SetServerTelemetryHandler(Server::TelemetryHandleFunctionServer handler) {
+    this->m_telemetryHandler_ = std::move(handler);
+}
+
 uint16_t Server::SetServerPort(const uint16_t port) {
     this->port_ = port;
     StartServer();
@@ -172,6 +200,8 @@ SocketStatusInfo Server::StartServer() {
     }
 
     m_serverStatus_ = SocketStatusInfo::Connected;
+    StartSnapshotLoop();
+    StartSessionWriter();
     m_threadPoolServer_.AddTask([this]{HandlingAcceptLoop();});
     m_threadPoolServer_.AddTask([this]{WaitingDataLoop();});
 
@@ -276,9 +306,11 @@ void Server::HandlingAcceptLoop() {
     if(SocketHandle_t clientSocket = accept(m_socketServer_, (struct sockaddr*)&clientAddr, &addrLen);
               clientSocket != 0 && m_serverStatus_ == SocketStatusInfo::Connected)
     {
-        if (EnableKeepAlive(clientSocket))
+        if (AdmitConnection(clientSocket, clientAddr.sin_addr.S_un.S_addr) && EnableKeepAlive(clientSocket))
         {
             std::unique_ptr<InterfaceClientSession> client(new InterfaceClientSession(clientSocket, clientAddr));
+            m_counters_.OnConnect(client->GetHost());
+            client->m_hostBucket_ = m_rateLimiter_.GetHostBucket(client->GetHost());
             m_connectHandle_(*client);
             m_clientMutex_.lock();
             m_session_list_.emplace_back(std::move(client));
@@ -290,8 +322,10 @@ void Server::HandlingAcceptLoop() {
     }
 #else
     if (SocketHandle_t clientSocket = accept4(m_socketServer_, (struct sockaddr*)&clientAddr, &addrLen, SOCK_NONBLOCK); clientSocket >= 0 && m_serverStatus_ == SocketStatusInfo::Connected) {
-        if(EnableKeepAlive(clientSocket)) {
+        if(AdmitConnection(clientSocket, clientAddr.sin_addr.s_addr) && EnableKeepAlive(clientSocket)) {
             std::unique_ptr<InterfaceClientSession> client(new InterfaceClientSession(clientSocket, clientAddr));
+            m_counters_.OnConnect(client->GetHost());
+            client->m_hostBucket_ = m_rateLimiter_.GetHostBucket(client->GetHost());
             m_connectHandle_(*client);
             m_clientMutex_.lock();
             m_session_list_.emplace_back(std::move(client));
@@ -367,26 +401,108 @@ bool Server::EnableKeepAlive(SocketHandle_t socket) {
     return true;
 }
 
+bool Server::AdmitConnection(SocketHandle_t socket, uint32_t host) {
+    AdmissionLimit exceeded;
+    if (m_admission_.maxConnections && m_counters_.GetConnectionCount() >= m_admission_.maxConnections) {
+        exceeded = AdmissionLimit::Connections;
+    } else if (m_admission_.maxConnectionsPerHost
+               && m_counters_.GetHostConnectionCount(host) >= m_admission_.maxConnectionsPerHost) {
+        exceeded = AdmissionLimit::HostConnections;
+    } else {
+        return true;
+    }
+    m_admissionRejected_[static_cast<size_t>(exceeded)].fetch_add(1, std::memory_order_relaxed);
+
+    uint8_t frame[sizeof(uint32_t) + sizeof(ProtocolError)];
+    uint32_t header = MakeFrameHeader(FrameType::Error, sizeof(ProtocolError));
+    memcpy(frame, &header, sizeof(header));
+    frame[sizeof(header)] = static_cast<uint8_t>(ProtocolError::AdmissionRejected);
+    send(socket, reinterpret_cast<const char*>(frame), sizeof(frame), NIX(MSG_NOSIGNAL) WIN(0));
+    return false;
+}
+
 void Server::WaitingDataLoop() {
+    // Flush only queues frames on subscribers; pool tasks scheduled below send them.
+    int64_t nowMilliseconds = CoarseClock::Instance().NowMilliseconds();
+    m_presence_.Flush(nowMilliseconds, m_counters_, m_userNames_);
     {
         std::lock_guard lockGuard(m_clientMutex_);
+        bool rateLimited = m_rateLimits_.Enabled();
+        int64_t now = nowMilliseconds * 1000;
         for (auto begin = m_session_list_.begin(), end = m_session_list_.end(); begin != end; ++begin) {
             auto &client = *begin;
             if (client) {
-                if (DataBuffer_t dataBuffer = client->LoadData(); !dataBuffer.empty()) {
-                    m_threadPoolServer_.AddTask([this, data = std::move(dataBuffer), &client] {
-                        client->m_accessMutex_.lock();
-                        m_handler_(data, *client);
-                        client->m_accessMutex_.unlock();
+                // The task holds the session, not its list slot, which the disconnect task clears and
+                // erases; that task is only queued once no send is outstanding.
+                if (client->m_connectionStatus_ != SocketStatusInfo::Disconnected
+                    && client->m_presencePending_.exchange(false, std::memory_order_acq_rel)) {
+                    InterfaceClientSession* session = client.get();
+                    session->m_presenceTasks_.fetch_add(1, std::memory_order_relaxed);
+                    m_threadPoolServer_.AddTask([session] {
+                        session->m_accessMutex_.lock();
+                        session->SendQueuedPresence();
+                        session->m_accessMutex_.unlock();
+                        session->m_presenceTasks_.fetch_sub(1, std::memory_order_release);
                     });
-                } else if (client->m_connectionStatus_ == SocketStatusInfo::Disconnected) {
+                }
+                // Leaving the frame in the socket lets TCP flow control slow the sender down.
+                if (rateLimited && m_rateLimits_.action == RateLimitAction::Delay
+                    && client->m_connectionStatus_ == SocketStatusInfo::Connected
+                    && !client->RateLimitReady(m_rateLimits_, now)) {
+                    if (!client->m_rateDelayed_) {
+                        client->m_rateDelayed_ = true;
+                        m_rateLimited_[static_cast<size_t>(RateLimitAction::Delay)].fetch_add(1, std::memory_order_relaxed);
+                    }
+                    continue;
+                }
+                if (Frame frame = client->LoadFrame(m_frameLimits_, static_cast<bool>(m_viewHandler_));
+                        frame.error != ProtocolError::None) {
+                    m_rejectedFrames_[static_cast<size_t>(frame.error)].fetch_add(1, std::memory_order_relaxed);
+                } else if (!frame.Empty()) {
+                    client->m_rateDelayed_ = false;
+                    // A delayed frame was only read once both buckets had room. A stream chunk is never
+                    // dropped, since the stream would lose data and the window its credit; its window
+                    // already bounds it, so it is only charged.
+                    bool admitted = true;
+                    if (rateLimited && (m_rateLimits_.action == RateLimitAction::Delay
+                                        || (m_rateLimits_.action == RateLimitAction::Drop && frame.type == FrameType::StreamChunk))) {
+                        client->ChargeRateLimit(m_rateLimits_, now);
+                    } else if (rateLimited) {
+                        admitted = client->ConsumeRateLimit(m_rateLimits_, now);
+                    }
+                    if (!admitted) {
+                        m_rateLimited_[static_cast<size_t>(m_rateLimits_.action)].fetch_add(1, std::memory_order_relaxed);
+                        if (m_rateLimits_.action == RateLimitAction::Disconnect) {
+                            RejectFrame(*client, ProtocolError::RateLimited);
+                        }
+                        BufferPool::Instance().Release(std::move(frame.payload));
+                        continue;
+                    }
+                    DispatchFrame(std::move(frame), client);
+                } else if (client->m_connectionStatus_ == SocketStatusInfo::Disconnected && !client->m_closing_
+                           && !client->m_presenceTasks_.load(std::memory_order_acquire)) {
+                    // Queued once; the slot is cleared and erased under the client mutex, which this
+                    // loop holds while it walks the list.
+                    client->m_closing_ = true;
                     m_threadPoolServer_.AddTask([this, &client, begin] {
                         client->m_accessMutex_.lock();
-                        InterfaceClientSession *pointer = client.release();
-                        client = nullptr;
+                        InterfaceClientSession *pointer;
+                        {
+                            std::lock_guard lockGuard(m_clientMutex_);
+                            pointer = client.release();
+                        }
                         pointer->m_accessMutex_.unlock();
+                        m_counters_.OnDisconnect(pointer->GetHost());
+                        m_presence_.RemoveSubscriber(*pointer);
+                        if (pointer->GetUserId() != kInvalidUserId) {
+                            m_counters_.OnSessionClose(pointer->GetUserId());
+                            m_presence_.MarkChanged(pointer->GetUserId(), CoarseClock::Instance().NowMilliseconds());
+                        }
                         m_disconnectHandle_(*pointer);
-                        m_session_list_.erase(begin);
+                        {
+                            std::lock_guard lockGuard(m_clientMutex_);
+                            m_session_list_.erase(begin);
+                        }
                         delete pointer;
 
                     });
@@ -399,19 +515,156 @@ void Server::WaitingDataLoop() {
     }
 }
 
+void Server::DispatchFrame(Frame frame, std::unique_ptr<InterfaceClientSession>& client) {
+    switch (frame.type) {
+        case FrameType::Data:
+            if (!frame.view.Empty()) {
+                m_threadPoolServer_.AddTask([this, view = std::move(frame.view), &client] {
+                    client->m_accessMutex_.lock();
+                    m_viewHandler_(view, *client);
+                    client->m_accessMutex_.unlock();
+                });
+                break;
+            }
+            m_threadPoolServer_.AddTask([this, data = std::move(frame.payload), &client]() mutable {
+                client->m_accessMutex_.lock();
+                m_handler_(data, *client);
+                client->m_accessMutex_.unlock();
+                BufferPool::Instance().Release(std::move(data));
+            });
+            break;
+        case FrameType::StreamChunk: {
+            StreamChunk chunk;
+            if (!ParseStreamChunk(std::move(frame.payload), chunk) || !client->PushStreamChunk(std::move(chunk))) {
+                RejectFrame(*client, ProtocolError::StreamViolation);
+                break;
+            }
+            m_threadPoolServer_.AddTask([this, &client] {
+                client->m_accessMutex_.lock();
+                StreamChunk pending;
+                if (client->PopStreamChunk(pending)) {
+                    m_streamHandler_(pending, *client);
+                    client->ReleaseStreamWindow(pending.streamId, static_cast<uint32_t>(pending.Size()));
+                    BufferPool::Instance().Release(std::move(pending.payload));
+                }
+                client->m_accessMutex_.unlock();
+            });
+            break;
+        }
+        case FrameType::Telemetry: {
+            PcDataRecord record;
+            bool isDecoded = PcDataSchema::Decode(frame.payload, record);
+            BufferPool::Instance().Release(std::move(frame.payload));
+            if (!isDecoded) {
+                RejectFrame(*client, ProtocolError::MalformedPayload);
+                break;
+            }
+            m_threadPoolServer_.AddTask([this, record = std::move(record), &client] {
+                client->m_accessMutex_.lock();
+                m_telemetryHandler_(record, *client);
+                client->m_accessMutex_.unlock();
+            });
+            break;
+        }
+        case FrameType::PresenceSubscribe:
+            HandlePresenceSubscribe(frame.payload, *client);
+            BufferPool::Instance().Release(std::move(frame.payload));
+            break;
+        case FrameType::Error:
+            client->Disconnect();
+            break;
+        default:
+            RejectFrame(*client, ProtocolError::UnknownFrameType);
+            break;
+    }
+}
+
+void Server::HandlePresenceSubscribe(const DataBuffer_t& payload, InterfaceClientSession& client) {
+    PresenceSubscribeRecord request;
+    if (!PresenceSubscribeSchema::Decode(payload, request) || request.user_.empty()) {
+        RejectFrame(client, ProtocolError::MalformedPayload);
+        return;
+    }
+    if (client.GetUserId() == kInvalidUserId) {
+        RejectFrame(client, ProtocolError::NotAuthenticated);
+        return;
+    }
+    // A user that never authenticated is offline and has nothing to publish, so it is not subscribed.
+    UserId_t userId = m_userNames_.Find(request.user_);
+    if (!request.subscribe_) {
+        if (userId != kInvalidUserId) {
+            m_presence_.Unsubscribe(client, userId);
+        }
+        return;
+    }
+
+    PresenceRecord record;
+    record.user_ = std::move(request.user_);
+    record.state_ = PresenceState::Offline;
+    if (userId != kInvalidUserId) {
+        PresenceState current = m_counters_.GetUserSessionCount(userId) ? PresenceState::Online : PresenceState::Offline;
+        record.state_ = m_presence_.Subscribe(client, userId, current);
+    }
+    record.changedAt_ = CoarseClock::Instance().NowSeconds();
+    std::shared_ptr<DataBuffer_t> frame = BufferPool::Instance().AcquireShared(sizeof(uint32_t));
+    if (PresenceSchema::Encode(record, *frame)) {
+        uint32_t header = MakeFrameHeader(FrameType::Presence, static_cast<uint32_t>(frame->size() - sizeof(header)));
+        memcpy(frame->data(), &header, sizeof(header));
+        client.QueuePresence(std::move(frame));
+    }
+}
+
+void TokenBucket::Consume(const RateLimit& limit, int64_t now) {
+    int64_t fullAt = m_fullAt_.load(std::memory_order_relaxed);
+    while (!m_fullAt_.compare_exchange_weak(fullAt, std::max(fullAt, now) + limit.Interval(), std::memory_order_relaxed)) {}
+}
+
+TokenBucket* RateLimiter::GetBucket(Shards& shards, uint32_t key) {
+    Shard& shard = shards[(key * 0x9E3779B1u) >> 28];
+    std::lock_guard lock(shard.mutex);
+    return &shard.buckets[key];
+}
+
+bool Server::InterfaceClientSession::RateLimitReady(const RateLimitConfig& config, int64_t now) const {
+    TokenBucket* userBucket = m_userBucket_.load(std::memory_order_acquire);
+    return (!config.perHost.Enabled() || !m_hostBucket_ || m_hostBucket_->Ready(config.perHost, now))
+           && (!config.perUser.Enabled() || !userBucket || userBucket->Ready(config.perUser, now));
+}
+
+bool Server::InterfaceClientSession::ConsumeRateLimit(const RateLimitConfig& config, int64_t now) {
+    if (!RateLimitReady(config, now)) {
+        return false;
+    }
+    ChargeRateLimit(config, now);
+    return true;
+}
+
+void Server::InterfaceClientSession::ChargeRateLimit(const RateLimitConfig& config, int64_t now) {
+    if (config.perHost.Enabled() && m_hostBucket_) {
+        m_hostBucket_->Consume(config.perHost, now);
+    }
+    if (TokenBucket* userBucket = m_userBucket_.load(std::memory_order_acquire); config.perUser.Enabled() && userBucket) {
+        userBucket->Consume(config.perUser, now);
+    }
+}
+
+void Server::RejectFrame(InterfaceClientSession& client, ProtocolError error) {
+    m_rejectedFrames_[static_cast<size_t>(error)].fetch_add(1, std::memory_order_relaxed);
+    client.RejectFrame(error);
+}
+
 void Server::printUserInfo(const Server::UserInfo &userInfo) {
     std::cout << "Password: " << userInfo.password_ << std::endl;
-    std::cout << "Date Today: " << userInfo.timeToday_ << std::endl;
+    std::cout << "Date Today: " << FormatDate(userInfo.connectTime_) << std::endl;
     std::cout << "Session Port: " << userInfo.sessionPort_ << std::endl;
-    std::cout << "Time connect: " << userInfo.connectTime_ << std::endl;
-    std::cout << "Time disconnect: " << userInfo.disconnectTime_ << std::endl;
-    std::cout << "Duration Time: " << userInfo.duration_ << std::endl;
+    std::cout << "Time connect: " << FormatDateTime(userInfo.connectTime_) << std::endl;
+    std::cout << "Time disconnect: " << (userInfo.disconnectTime_ ? FormatDateTime(userInfo.disconnectTime_) : "") << std::endl;
+    std::cout << "Duration Time: " << (userInfo.disconnectTime_ ? FormatDuration(userInfo.duration_) : "") << std::endl;
 }
 
 void Server::printAllUsersInfo() {
-    std::lock_guard<std::mutex> lock(usersMutex);
-    for (const auto& pair : users) {
-        std::cout << "Username: " << pair.first << std::endl;
+    for (const auto& pair : m_users_.TakeSnapshot()) {
+        std::cout << "Username: " << m_userNames_.GetName(pair.first) << std::endl;
         std::cout << "User Info:" << std::endl;
         for (const auto& userInfo : pair.second) {
             printUserInfo(userInfo);
@@ -421,331 +674,1899 @@ void Server::printAllUsersInfo() {
     }
 }
 
-void Server::initializeDatabase() {
-    int rc;
-    char* errorMsg = nullptr;
-
-    rc = sqlite3_open(DB_PATH, &dbConnection);
-    if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(dbConnection) << std::endl;
-        sqlite3_close(dbConnection);
-        return;
-    }
-
-    rc = sqlite3_exec(dbConnection, "BEGIN TRANSACTION", nullptr, nullptr, &errorMsg);
-    rc = sqlite3_exec(dbConnection, "PRAGMA foreign_keys = OFF", nullptr, nullptr, &errorMsg);
-    rc = sqlite3_exec(dbConnection, "CREATE TABLE IF NOT EXISTS UserInfo ("
-                                    "username TEXT,"
-                                    "password TEXT,"
-                                    "sessionPort INTEGER,"
-                                    "connectTime TEXT,"
-                                    "disconnectTime TEXT,"
-                                    "duration TEXT,"
-                                    "timeToday TEXT"
-                                    ")", nullptr, nullptr, &errorMsg);
-    rc = sqlite3_exec(dbConnection, "COMMIT", nullptr, nullptr, &errorMsg);
-
-    if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << errorMsg << std::endl;
-        sqlite3_free(errorMsg);
-    } else {
-        std::cout << "Database initialized successfully." << std::endl;
-    }
+void Server::printBufferPoolStats() {
+    BufferPool::Stats stats = BufferPool::Instance().GetStats();
+    std::cout << "Buffer pool hit rate: " << std::fixed << std::setprecision(2) << stats.HitRate() * 100 << "%" << std::endl;
+    std::cout << "Local hits: " << stats.localHits << " Shared hits: " << stats.sharedHits << std::endl;
+    std::cout << "Misses: " << stats.misses << " Oversized: " << stats.oversized << std::endl;
+    std::cout << "Released: " << stats.released << " Dropped: " << stats.dropped << std::endl;
 }
 
-void Server::writeToDatabase(const Server::UserInfo &userInfo) {
-    int rc;
-    char* errorMsg = nullptr;
+void Server::printFrameStats() {
+    std::cout << "Rejected frames:" << std::endl;
+    std::cout << "Too large: " << GetRejectedFrameCount(ProtocolError::FrameTooLarge) << std::endl;
+    std::cout << "Unknown type: " << GetRejectedFrameCount(ProtocolError::UnknownFrameType) << std::endl;
+    std::cout << "Malformed payload: " << GetRejectedFrameCount(ProtocolError::MalformedPayload) << std::endl;
+    std::cout << "Stream violation: " << GetRejectedFrameCount(ProtocolError::StreamViolation) << std::endl;
+    std::cout << "Rate limited: " << GetRejectedFrameCount(ProtocolError::RateLimited) << std::endl;
+    std::cout << "Not authenticated: " << GetRejectedFrameCount(ProtocolError::NotAuthenticated) << std::endl;
+}
 
-    std::string insertSQL = "INSERT INTO UserInfo (username, password, sessionPort, connectTime, disconnectTime, duration, timeToday) VALUES (?, ?, ?, ?, ?, ?, ?)";
+void Server::printWriterStats() {
+    std::cout << "Session writer: " << m_writtenSessions_.load(std::memory_order_relaxed) << " sessions in "
+              << m_writerCommits_.load(std::memory_order_relaxed) << " commits (" << m_failedBatches_.load(std::memory_order_relaxed) << " failed), "
+              << m_sessionLog_.GetSize() << " queued (peak " << GetSessionQueuePeak() << " of " << m_sessionLog_.GetCapacity()
+              << "), " << m_sessionLog_.GetOverflowCount() << " overflowed, " << GetDroppedSessionCount() << " dropped" << std::endl;
+    std::cout << "Session spool: " << m_spool_.GetSpilledCount() << " spilled (" << m_spool_.GetSpilledBytes() << " bytes), "
+              << m_spool_.GetDrainedCount() << " drained, " << m_spool_.GetPendingCount() << " pending, "
+              << m_spool_.GetLostCount() << " lost" << std::endl;
+    std::lock_guard lock(m_sinkMutex_);
+    std::cout << "Session sink: " << m_sink_->GetName() << std::endl;
+    m_sink_->PrintStats();
+}
 
-    sqlite3_stmt* stmt;
+void Server::printDatabaseStats() {
+    std::cout << "Database readers: " << m_database_.GetReaderCount() << " of " << m_database_.GetReaderLimit() << " open, "
+              << m_database_.GetLeaseCount() << " leases, " << m_database_.GetWaitCount() << " waits" << std::endl;
+}
 
-    rc = sqlite3_prepare_v2(dbConnection, insertSQL.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(dbConnection) << std::endl;
-        return;
+// Reads only the partition that covers the day instead of the view over all of them. The query
+// names the partition, so it is prepared per call rather than kept in the reader's cache.
+bool Server::QueryUserTime(const std::string& username, int64_t day, int64_t& seconds) {
+    ConnectionManager::Reader reader = m_database_.AcquireReader();
+    if (!reader) {
+        return false;
+    }
+    sqlite3* connection = reader.GetHandle();
+    seconds = 0;
+    for (const std::string& partition : FindSessionPartitions(connection, day, day)) {
+        std::string sql = "SELECT COALESCE(SUM(duration), 0) FROM \"" + partition + "\" WHERE username = ? AND day = ?";
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(connection, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Failed to prepare SQL statement: " << sqlite3_errmsg(connection) << std::endl;
+            sqlite3_finalize(stmt);
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, day);
+        bool found = sqlite3_step(stmt) == SQLITE_ROW;
+        if (found) {
+            seconds += sqlite3_column_int64(stmt, 0);
+        } else {
+            std::cerr << "Error reading from database: " << sqlite3_errmsg(connection) << std::endl;
+        }
+        sqlite3_finalize(stmt);
+        if (!found) {
+            return false;
+        }
     }
+    return true;
+}
 
-    rc = sqlite3_bind_text(stmt, 1, userInfo.username_.c_str(), -1, SQLITE_STATIC);
-    rc = sqlite3_bind_text(stmt, 2, userInfo.password_.c_str(), -1, SQLITE_STATIC);
-    rc = sqlite3_bind_int(stmt, 3, userInfo.sessionPort_);
-    rc = sqlite3_bind_text(stmt, 4, userInfo.connectTime_.c_str(), -1, SQLITE_STATIC);
-    rc = sqlite3_bind_text(stmt, 5, userInfo.disconnectTime_.c_str(), -1, SQLITE_STATIC);
-    rc = sqlite3_bind_text(stmt, 6, userInfo.duration_.c_str(), -1, SQLITE_STATIC);
-    rc = sqlite3_bind_text(stmt, 7, userInfo.timeToday_.c_str(), -1, SQLITE_STATIC);
+void Server::printAdmissionStats() {
+    std::cout << "Admission rejected:" << std::endl;
+    std::cout << "Server connections: " << GetAdmissionRejectedCount(AdmissionLimit::Connections) << std::endl;
+    std::cout << "Host connections: " << GetAdmissionRejectedCount(AdmissionLimit::HostConnections) << std::endl;
+    std::cout << "User sessions: " << GetAdmissionRejectedCount(AdmissionLimit::UserSessions) << std::endl;
+}
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        std::cerr << "Error executing SQL statement: " << sqlite3_errmsg(dbConnection) << std::endl;
-    } else {
-        std::cout << "Data written to database successfully." << std::endl;
+void Server::printRateLimitStats() {
+    std::cout << "Rate limiting:" << std::endl;
+    std::cout << "Delayed frames: " << GetRateLimitedCount(RateLimitAction::Delay) << std::endl;
+    std::cout << "Dropped frames: " << GetRateLimitedCount(RateLimitAction::Drop) << std::endl;
+    std::cout << "Disconnects: " << GetRateLimitedCount(RateLimitAction::Disconnect) << std::endl;
+}
+
+void Server::printSessionCounts(const std::string& username) {
+    if (!username.empty()) {
+        std::cout << "User '" << username << "' sessions: " << GetUserSessionCount(username) << std::endl;
+        return;
     }
+    std::cout << "Connections: " << GetConnectionCount() << std::endl;
+    std::cout << "Authenticated sessions: " << GetSessionCount() << std::endl;
+    std::cout << "Presence updates: " << m_presence_.GetPublishedCount()
+              << " sent, " << m_presence_.GetSuppressedCount() << " coalesced, "
+              << m_presence_.GetDroppedCount() << " dropped on full queues" << std::endl;
+}
 
-    sqlite3_finalize(stmt);
+uint32_t Server::GetUserSessionCount(std::string_view username) const {
+    UserId_t userId = m_userNames_.Find(username);
+    return userId == kInvalidUserId ? 0 : m_counters_.GetUserSessionCount(userId);
 }
 
-void Server::clearUser(const std::string &username) {
-    std::lock_guard<std::mutex> lock(usersMutex);
-    auto it = users.find(username);
-    if (it != users.end()) {
-        it->second.clear();
-        users.erase(it);
+std::unique_ptr<Server::SessionSink> Server::MakeSessionSink(const SessionSinkConfig& config, ConnectionManager& database) {
+    switch (config.type) {
+        case SessionSinkType::BinaryLog:
+            return std::make_unique<BinaryLogSessionSink>(config.logPath, config.syncLog);
+        case SessionSinkType::Null:
+            return std::make_unique<NullSessionSink>();
+        case SessionSinkType::Journal:
+            return std::make_unique<JournalSessionSink>(config.journalPath, config.syncLog, database);
+        default:
+            return std::make_unique<SqliteSessionSink>(database);
     }
 }
 
-
-Server::InterfaceClientSession::InterfaceClientSession(SocketHandle_t socket, SocketAddressIn_t address)
-        : m_address_(address), m_socketDescriptor_(socket){
-    SetFirstConnectionTime();
+// Local day of the epoch, in the UTC offset in force at that moment.
+static int64_t SessionDay(int64_t epoch) {
+    return SessionDayFromEpoch(epoch, CoarseClock::GetUtcOffsetAt(epoch));
 }
 
+static int64_t SessionToday() {
+    return SessionDayFromEpoch(CoarseClock::Instance().NowSeconds(), CoarseClock::Instance().GetUtcOffset());
+}
 
-Server::InterfaceClientSession::~InterfaceClientSession(){
-    InterfaceClientSession::Disconnect();
-#ifdef _WIN32
-    if(m_socketDescriptor_ == INVALID_SOCKET) {
+Server::SqliteSessionSink::SqliteSessionSink(ConnectionManager& database)
+        :   m_connection_(database.GetWriter()),
+            m_statements_(database.GetWriterStatements()),
+            m_partitions_(m_connection_, m_statements_, database.GetConfig().partitionPeriod),
+            m_retentionDays_(database.GetConfig().retentionDays)
+{
+    if (!m_connection_) {
         return;
     }
-    shutdown(m_socketDescriptor_, SD_BOTH);
-    closesocket(m_socketDescriptor_);
-#else
-    if(m_socketDescriptor_ == -1) {
-        return;
+    if (!m_partitions_.Initialize(SessionToday())) {
+        std::cerr << "Failed to initialize the session schema: " << sqlite3_errmsg(m_connection_) << std::endl;
+    } else {
+        m_migrationPending_ = HasLegacySessions(m_connection_);
+        std::cout << "Database initialized successfully (" << GetProfileName(database.GetConfig().profile) << " profile, schema v"
+                  << kSessionSchemaVersion << (m_migrationPending_ ? ", migrating legacy sessions" : "") << ")." << std::endl;
     }
-    shutdown(m_socketDescriptor_, SD_BOTH);
-    close(m_socketDescriptor_);
-#endif
 }
 
-TCPInterfaceBase::SockStatusInfo_t Server::InterfaceClientSession::Disconnect() {
-    SetLastDisconnectionTime();
-    m_connectionStatus_ = SockStatusInfo_t::Disconnected;
-#ifdef _WIN32
-    if (m_socketDescriptor_ == INVALID_SOCKET) {
-        return m_connectionStatus_;
-    }
-    shutdown(m_socketDescriptor_, SD_BOTH);
-    closesocket(m_socketDescriptor_);
-    m_socketDescriptor_ = INVALID_SOCKET;
-#else
-    if (m_socketDescriptor_ == -1) {
-        return m_connectionStatus_;
+bool Server::SqliteSessionSink::Begin() {
+    return m_connection_ && m_statements_.Execute("BEGIN TRANSACTION") == SQLITE_OK;
+}
+
+bool Server::SqliteSessionSink::Write(const UserInfo& session, const UserNameTable& names) {
+    if (!m_connection_) {
+        return false;
     }
-    shutdown(m_socketDescriptor_, SD_BOTH);
-    close(m_socketDescriptor_);
-    m_socketDescriptor_ = -1;
-#endif
-    m_lastDisconnectionTime_ = std::chrono::system_clock::now();
-    return m_connectionStatus_;
+    SessionRow row;
+    row.username = names.GetName(session.userId_);
+    row.password = session.password_;
+    row.sessionPort = session.sessionPort_;
+    row.connectTime = session.connectTime_;
+    row.disconnectTime = session.disconnectTime_;
+    row.duration = session.duration_;
+    row.day = SessionDay(session.connectTime_);
+    return m_partitions_.Insert(row);
 }
 
-bool Server::InterfaceClientSession::SendData(const void *buffer, const size_t size) const {
-    if(m_connectionStatus_ != SocketStatusInfo::Connected) {
+bool Server::SqliteSessionSink::Commit() {
+    if (!m_connection_) {
         return false;
     }
-    void* sendBuffer = malloc(size + sizeof (uint32_t));
-    memcpy(reinterpret_cast<char*>(sendBuffer) + sizeof (uint32_t ), buffer, size);
-    *reinterpret_cast<uint32_t*>(sendBuffer) = size;
-    if(send(m_socketDescriptor_, reinterpret_cast<char*>(sendBuffer), static_cast<int>(size + sizeof(uint32_t)), 0) < 0){
+    if (m_statements_.Execute("COMMIT") != SQLITE_OK) {
+        std::cerr << "Failed to commit sessions: " << sqlite3_errmsg(m_connection_) << std::endl;
+        m_statements_.Execute("ROLLBACK");
+        // Partitions created in the batch are gone with it.
+        m_partitions_.Reload();
         return false;
     }
-    free(sendBuffer);
     return true;
 }
 
-DataBuffer_t Server::InterfaceClientSession::LoadData() {
-    if (m_connectionStatus_ != SocketStatusInfo::Connected) {
-        return DataBuffer_t();
+// One migration batch per writer round, so finished sessions are never queued behind the whole migration.
+void Server::SqliteSessionSink::Maintain() {
+    if (int64_t today = SessionToday(); today != m_rotatedDay_ && m_connection_) {
+        if (m_partitions_.Rotate(today, m_retentionDays_)) {
+            m_rotatedDay_ = today;
+        }
     }
-    DataBuffer_t dataBuffer;
-    uint32_t size;
-    int error = 0;
-#ifdef _WIN32
-    if (u_long t = true; SOCKET_ERROR == ioctlsocket(m_socketDescriptor_, FIONBIO, &t)) {
-        return DataBuffer_t();
+    int64_t now = CoarseClock::Instance().NowMilliseconds();
+    if (!m_migrationPending_ || !m_migrationRetry_.Ready(now)) {
+        return;
     }
-    int answer = recv(m_socketDescriptor_, (char *)&size, sizeof(size), 0);
-    if (u_long t = false; SOCKET_ERROR == ioctlsocket(m_socketDescriptor_, FIONBIO, &t)){
-        return DataBuffer_t();
+    int64_t moved = m_partitions_.MigrateLegacy();
+    if (moved < 0) {
+        std::cerr << "Legacy session migration failed, retrying in " << m_migrationRetry_.Fail(now) << " ms" << std::endl;
+        return;
     }
-#else
-    int answer = recv(m_socketDescriptor_, (char *)&size, sizeof(size), MSG_DONTWAIT);
-#endif
-    if (!answer) {
-        Disconnect();
-        return DataBuffer_t();
-    } else if (answer == -1) {
-        WIN (
-                error = convertError();
-                if (!error) {
-                    SocketLength_t length = sizeof (error);
-                    getsockopt(m_socketDescriptor_, SOL_SOCKET, SO_ERROR, WIN((char*))&error, &length);
-                }
-        )
-        NIX (
-                SocketLength_t length = sizeof (error);
-                getsockopt(m_socketDescriptor_, SOL_SOCKET, SO_ERROR, WIN((char*))&error, &length);
-                if (!error) {
-                    error = errno;
-                }
-        )
+    m_migrationRetry_.Succeed();
+    m_migratedSessions_.fetch_add(moved, std::memory_order_relaxed);
+    if (static_cast<size_t>(moved) < kMigrationBatchSize) {
+        m_migrationPending_ = false;
+        // The migration may have recreated partitions that are past retention.
+        m_rotatedDay_ = 0;
+        std::cout << "Legacy session migration finished: " << m_migratedSessions_.load(std::memory_order_relaxed)
+                  << " sessions." << std::endl;
     }
+}
 
-    switch (error) {
-        case 0:
-            break;
-        case ETIMEDOUT:
-        case ECONNRESET:
-        case EPIPE:
-            Disconnect();
-            [[fallthrough]];
-        case EAGAIN:
-            return DataBuffer_t();
-        default:
-            Disconnect();
-            std::cerr << "Unhandled error!\n"
-                      << "Code: " << error << " Error: " << std::strerror(error) << '\n';
-            return DataBuffer_t();
-    }
+void Server::SqliteSessionSink::Sync() {
+    CheckpointDatabase(m_connection_, true);
+}
 
-    if (!size) {
-        return DataBuffer_t();
-    }
+void Server::SqliteSessionSink::PrintStats() const {
+    std::cout << "Legacy sessions migrated: " << m_migratedSessions_.load(std::memory_order_relaxed) << std::endl;
+    std::cout << "Session partitions: " << m_partitions_.Size() << " open, " << m_partitions_.GetRetiredCount() << " retired" << std::endl;
+}
 
-    dataBuffer.resize(static_cast<std::vector<DataBuffer_t>::size_type>(size));
-    int recvResult = recv(m_socketDescriptor_, reinterpret_cast<char*>(dataBuffer.data()), static_cast<int>(dataBuffer.size()), 0);
-    if (recvResult < 0) {
-        int err = errno;
-        std::cerr << "Error receiving data: " << std::strerror(err) << '\n';
-        Disconnect();
-        return DataBuffer_t();
+Server::BinaryLogSessionSink::BinaryLogSessionSink(std::string path, bool sync)
+        :   m_path_(std::move(path)),
+            m_sync_(sync)
+{
+    m_file_ = std::fopen(m_path_.c_str(), "a+b");
+    if (!m_file_) {
+        std::cerr << "Can't open session log " << m_path_ << ": " << std::strerror(errno) << std::endl;
+        return;
     }
-
-    return dataBuffer;
+    uint32_t header[2] = {kMagic, kVersion};
+    if (std::fseek(m_file_, 0, SEEK_END) == 0 && std::ftell(m_file_) == 0) {
+        std::fwrite(header, sizeof(header), 1, m_file_);
+        std::fflush(m_file_);
+        return;
+    }
+    // Records of another version cannot be mixed into the file.
+    uint32_t existing[2] = {};
+    long size = std::ftell(m_file_);
+    std::rewind(m_file_);
+    if (std::fread(existing, sizeof(existing), 1, m_file_) != 1 || existing[0] != kMagic || existing[1] != kVersion) {
+        std::cerr << "Session log " << m_path_ << " has another format, move it away to start a new one" << std::endl;
+        std::fclose(m_file_);
+        m_file_ = nullptr;
+        return;
+    }
+    // A crash can leave half a batch at the end; appending after it would hide every later record
+    // from Replay, so the log is cut back to the last whole record first.
+    long valid = std::ftell(m_file_);
+    while (ReadRecord(m_file_, m_batch_, m_record_)) {
+        valid = std::ftell(m_file_);
+    }
+    m_batch_.clear();
+    if (valid < size) {
+        std::error_code error;
+        std::fflush(m_file_);
+        std::filesystem::resize_file(m_path_, static_cast<uintmax_t>(valid), error);
+        if (error) {
+            std::cerr << "Can't cut the torn tail off session log " << m_path_ << ": " << error.message() << std::endl;
+            std::fclose(m_file_);
+            m_file_ = nullptr;
+            return;
+        }
+        std::cerr << "Session log " << m_path_ << ": dropped " << size - valid << " bytes of a torn last batch" << std::endl;
+    }
+    std::fseek(m_file_, 0, SEEK_END);
 }
 
-uint32_t Server::InterfaceClientSession::GetHost() const {
-    return
-            WIN (
-                    m_address_.sin_addr.S_un.S_addr
-            )
-            NIX (
-                    m_address_.sin_addr.s_addr
-            );
+bool Server::BinaryLogSessionSink::ReadRecord(std::FILE* file, DataBuffer_t& payload, SessionLogRecord& record) {
+    uint32_t length;
+    if (std::fread(&length, sizeof(length), 1, file) != 1 || length > kMaxRecordSize) {
+        return false;
+    }
+    payload.resize(length);
+    return std::fread(payload.data(), 1, length, file) == length && SessionLogRecordSchema::Decode(payload, record);
 }
 
-uint16_t Server::InterfaceClientSession::GetPort() const {
-    return m_address_.sin_port;
+Server::BinaryLogSessionSink::~BinaryLogSessionSink() {
+    if (m_file_) {
+        std::fclose(m_file_);
+    }
 }
 
-std::string Server::InterfaceClientSession::ConnectionTimes(const InterfaceClientSession& client, Server& server) {
-    std::chrono::system_clock::time_point firstConnectionTime = client.GetFirstConnectionTime();
-    std::chrono::system_clock::time_point lastDisconnectionTime = client.GetLastDisconnectionTime();
+bool Server::BinaryLogSessionSink::Write(const UserInfo& session, const UserNameTable& names) {
+    if (!m_file_) {
+        return false;
+    }
+    m_record_.connectTime_ = session.connectTime_;
+    m_record_.disconnectTime_ = session.disconnectTime_;
+    m_record_.duration_ = session.duration_;
+    m_record_.sessionPort_ = session.sessionPort_;
+    m_record_.user_ = names.GetName(session.userId_);
+    m_record_.password_ = session.password_;
+
+    size_t offset = m_batch_.size();
+    m_batch_.resize(offset + sizeof(uint32_t));
+    if (!SessionLogRecordSchema::Encode(m_record_, m_batch_)) {
+        m_batch_.resize(offset);
+        return false;
+    }
+    auto length = static_cast<uint32_t>(m_batch_.size() - offset - sizeof(uint32_t));
+    memcpy(m_batch_.data() + offset, &length, sizeof(length));
+    return true;
+}
 
-    std::chrono::seconds duration = std::chrono::duration_cast<std::chrono::seconds>(lastDisconnectionTime - firstConnectionTime);
+bool Server::BinaryLogSessionSink::Commit() {
+    bool written = m_file_
+                   && std::fwrite(m_batch_.data(), 1, m_batch_.size(), m_file_) == m_batch_.size()
+                   && std::fflush(m_file_) == 0;
+    if (!written) {
+        std::cerr << "Failed to append to session log " << m_path_ << std::endl;
+    } else {
+        m_writtenBytes_.fetch_add(m_batch_.size(), std::memory_order_relaxed);
+        if (m_sync_) {
+            Sync();
+        }
+    }
+    m_batch_.clear();
+    return written;
+}
 
-    auto hours = std::chrono::duration_cast<std::chrono::hours>(duration);
-    duration -= hours;
-    auto minutes = std::chrono::duration_cast<std::chrono::minutes>(duration);
-    duration -= minutes;
-    auto seconds = duration;
+void Server::BinaryLogSessionSink::Sync() {
+    if (m_file_) {
+        WIN(_commit)NIX(fsync)(WIN(_fileno)NIX(fileno)(m_file_));
+    }
+}
 
-    std::ostringstream oss;
-    oss << std::setfill('0') << std::setw(2) << hours.count() << ":"
-        << std::setfill('0') << std::setw(2) << minutes.count() << ":"
-        << std::setfill('0') << std::setw(2) << seconds.count();
+void Server::BinaryLogSessionSink::PrintStats() const {
+    std::cout << "Session log " << m_path_ << ": " << m_writtenBytes_.load(std::memory_order_relaxed) << " bytes appended" << std::endl;
+}
 
-    return oss.str();
+size_t Server::BinaryLogSessionSink::Replay(const std::string& path, const std::function<void(const SessionLogRecord&)>& handler) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    size_t replayed = 0;
+    uint32_t header[2];
+    if (std::fread(header, sizeof(header), 1, file) == 1 && header[0] == kMagic && header[1] == kVersion) {
+        DataBuffer_t payload;
+        SessionLogRecord record;
+        while (ReadRecord(file, payload, record)) {
+            handler(record);
+            ++replayed;
+        }
+    }
+    std::fclose(file);
+    return replayed;
 }
 
+static uint32_t JournalChecksum(const uint8_t* record, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = sizeof(uint32_t); i < size; ++i) {
+        hash = (hash ^ record[i]) * 16777619u;
+    }
+    return hash;
+}
 
+static size_t JournalNameSlots(size_t length) {
+    constexpr size_t kInline = sizeof(Server::JournalRecord::name_);
+    constexpr size_t kSlot = sizeof(Server::JournalRecord);
+    return 1 + (length > kInline ? (length - kInline + kSlot - 1) / kSlot : 0);
+}
 
-bool Server::InterfaceClientSession::AutentficateUserInfo(const DataBuffer_t& data,Server::InterfaceClientSession& client, Server& server) {
-    std::string timeStr = client.GetDayNow();
-    uint16_t port = client.GetPort();
-    std::string connectionTime = client.GetConnectionTime();
+Server::JournalSessionSink::JournalSessionSink(std::string directory, bool sync, ConnectionManager& database)
+        :   m_directory_(std::move(directory)),
+            m_sync_(sync),
+            m_connection_(database.GetWriter()),
+            m_statements_(database.GetWriterStatements()),
+            m_partitions_(m_connection_, m_statements_, database.GetConfig().partitionPeriod),
+            m_retentionDays_(database.GetConfig().retentionDays)
+{
+    std::error_code error;
+    std::filesystem::create_directories(m_directory_, error);
+
+    if (m_connection_ && m_partitions_.Initialize(SessionToday())) {
+        m_migrationPending_ = HasLegacySessions(m_connection_);
+        m_statements_.Execute("CREATE TABLE IF NOT EXISTS JournalSegments ("
+                              "segment INTEGER PRIMARY KEY,"
+                              "sessions INTEGER NOT NULL,"
+                              "compactedAt INTEGER NOT NULL"
+                              ")");
+    }
 
-    std::string receivedMessageAll(data.begin(), data.end());
-    receivedMessageAll.erase(std::remove(receivedMessageAll.begin(), receivedMessageAll.end(), '\0'), receivedMessageAll.end());
+    uint64_t lastSegment = 0;
+    if (StatementCache::Statement stmt = m_statements_.Acquire("SELECT COALESCE(MAX(segment), 0) FROM JournalSegments")) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            lastSegment = sqlite3_column_int64(stmt, 0);
+        }
+    }
+    std::vector<uint64_t> leftover;
+    for (const auto& entry : std::filesystem::directory_iterator(m_directory_, error)) {
+        unsigned long long segment;
+        char tail;
+        if (sscanf(entry.path().filename().string().c_str(), "segment-%llu.journal%c", &segment, &tail) == 1) {
+            leftover.push_back(segment);
+            lastSegment = std::max<uint64_t>(lastSegment, segment);
+        }
+    }
+    std::sort(leftover.begin(), leftover.end());
+    m_sealedSegments_.assign(leftover.begin(), leftover.end());
+    if (!leftover.empty()) {
+        std::cout << "Recovering " << leftover.size() << " journal segments." << std::endl;
+    }
 
-    std::string receivedMessage = receivedMessageAll.substr(0);
+    OpenSegment(lastSegment + 1);
+    m_compactorThread_ = std::thread(&JournalSessionSink::CompactorLoop, this);
+}
 
-    size_t colonPos = receivedMessage.find(':');
-    if (colonPos == std::string::npos){
-        /*std::cerr << "User don`t detected" << std::endl;*/
-        return false;
+Server::JournalSessionSink::~JournalSessionSink() {
+    {
+        std::lock_guard lock(m_compactorMutex_);
+        m_compactorRunning_ = false;
+    }
+    m_compactorCondition_.notify_all();
+    if (m_compactorThread_.joinable()) {
+        m_compactorThread_.join();
     }
-    std::string username = receivedMessage.substr(0, colonPos);
-    client.username_ = username;
-    std::string password = receivedMessage.substr(colonPos + 1);
+    m_segment_.Flush(true);
+    m_segment_.Close();
+}
 
-    std::lock_guard<std::mutex> lock(server.usersMutex);
+std::string Server::JournalSessionSink::GetSegmentPath(uint64_t segment) const {
+    char name[40];
+    snprintf(name, sizeof(name), "segment-%016llu.journal", static_cast<unsigned long long>(segment));
+    return (std::filesystem::path(m_directory_) / name).string();
+}
 
-    auto it = server.users.find(username);
-    if(it == server.users.end()){
-        server.users.emplace(username, std::vector<UserInfo>{UserInfo(username,password,port,connectionTime,"", "", timeStr)});
-        std::cout << "User '" << username << "' has been assigned port: " << client.GetPort() << std::endl;
-    }
-    else {
-        it->second.emplace_back(username,password,port,connectionTime,"", "", timeStr);
-        std::cout << "User '" << username << "' authenticated successfully" << std::endl;
+bool Server::JournalSessionSink::OpenSegment(uint64_t segment) {
+    m_segmentId_ = segment;
+    if (!m_segment_.Open(GetSegmentPath(segment), kSegmentSize)) {
+        std::cerr << "Can't open journal segment " << GetSegmentPath(segment) << std::endl;
+        return false;
     }
+    JournalSegmentHeader header{};
+    header.magic_ = kMagic;
+    header.version_ = kVersion;
+    header.segment_ = segment;
+    header.createdAt_ = CoarseClock::Instance().NowSeconds();
+    memcpy(m_segment_.Data(), &header, sizeof(header));
+
+    m_segmentOpenedAt_ = header.createdAt_;
+    m_position_ = sizeof(header);
+    m_sequence_ = 0;
+    m_namedUsers_.clear();
     return true;
 }
 
-void Server::InterfaceClientSession::OnDisconnect(const InterfaceClientSession& client, Server& server) {
-    std::string username = client.GetUserNameIn();
-    uint16_t port = client.GetPort();
-    std::string sumDuration = Server::InterfaceClientSession::ConnectionTimes(client, server);
-    std::string lastConnection = Server::InterfaceClientSession::GetDisconnectionTime();
-
-    std::lock_guard<std::mutex> lock(server.usersMutex);
-    auto it = server.users.find(username);
-    if (it != server.users.end()) {
-        for (auto& userInfo : it->second) {
-            if (userInfo.sessionPort_ == port){
-                userInfo.duration_ = sumDuration;
-                userInfo.disconnectTime_ = lastConnection;
-                break;
-            }
-        }
+void Server::JournalSessionSink::SealSegment() {
+    m_segment_.Flush(true);
+    m_segment_.Close();
+    {
+        std::lock_guard lock(m_compactorMutex_);
+        m_sealedSegments_.push_back(m_segmentId_);
     }
+    m_compactorCondition_.notify_one();
+    OpenSegment(m_segmentId_ + 1);
 }
 
-void Server::InterfaceClientSession::WriteToDB(const InterfaceClientSession& client, Server& server) {
-    std::string username = client.GetUserNameIn();
-    auto it = server.users.find(username);
-
-    if (it != server.users.end()) {
-        for (const auto& userInfo : it->second) {
-            server.writeToDatabase(userInfo);
-        }
-        server.clearUser(username);
+void Server::JournalSessionSink::Append(JournalRecord& record, const std::string& name) {
+    size_t span = sizeof(record);
+    uint8_t* slot = m_segment_.Data() + m_position_;
+    record.sequence_ = m_sequence_++;
+    if (record.type_ == JournalRecordType::Name) {
+        span = JournalNameSlots(name.size()) * sizeof(record);
+        memset(slot, 0, span);
+        memcpy(slot + offsetof(JournalRecord, name_), name.data(), name.size());
+        memcpy(slot, &record, offsetof(JournalRecord, name_));
+    } else {
+        memcpy(slot, &record, sizeof(record));
     }
+    uint32_t checksum = JournalChecksum(slot, span);
+    memcpy(slot, &checksum, sizeof(checksum));
+    m_position_ += span;
 }
 
-std::string Server::InterfaceClientSession::GetDayNow() {
-    std::chrono::system_clock::time_point lastRequestTime = std::chrono::system_clock::now();
-    std::time_t t = std::chrono::system_clock::to_time_t(lastRequestTime);
-    char buft[80];
-    std::strftime(buft, sizeof(buft), "%Y-%m-%d", std::localtime(&t));
-    return std::string{buft};
+bool Server::JournalSessionSink::Write(const UserInfo& session, const UserNameTable& names) {
+    if (!m_segment_.IsOpen() && !OpenSegment(m_segmentId_)) {
+        return false;
+    }
+    bool named = m_namedUsers_.count(session.userId_);
+    std::string name = named ? std::string() : names.GetName(session.userId_);
+    size_t needed = (1 + (named ? 0 : JournalNameSlots(name.size()))) * sizeof(JournalRecord);
+    if (m_position_ + needed > m_segment_.Size()) {
+        SealSegment();
+        if (!m_segment_.IsOpen()) {
+            return false;
+        }
+        if (named) {
+            name = names.GetName(session.userId_);
+            named = false;
+        }
+    }
+
+    JournalRecord record{};
+    record.userId_ = session.userId_;
+    if (!named) {
+        record.type_ = JournalRecordType::Name;
+        record.duration_ = static_cast<uint32_t>(name.size());
+        Append(record, name);
+        m_namedUsers_.insert(session.userId_);
+    }
+    record.type_ = JournalRecordType::Session;
+    record.sessionPort_ = session.sessionPort_;
+    record.duration_ = session.duration_;
+    record.connectTime_ = session.connectTime_;
+    record.disconnectTime_ = session.disconnectTime_;
+    Append(record);
+    m_appendedSessions_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Without sync the records sit in the page cache: they survive a crash of the process, not of the machine.
+bool Server::JournalSessionSink::Commit() {
+    return !m_sync_ || m_segment_.Flush(true);
+}
+
+void Server::JournalSessionSink::Maintain() {
+    if (m_sequence_ && CoarseClock::Instance().NowSeconds() - m_segmentOpenedAt_ >= kSegmentMaxAge.count()) {
+        SealSegment();
+    }
+}
+
+void Server::JournalSessionSink::Sync() {
+    m_segment_.Flush(true);
+}
+
+void Server::JournalSessionSink::PrintStats() const {
+    std::cout << "Journal: " << m_appendedSessions_.load(std::memory_order_relaxed) << " sessions appended, "
+              << m_compactedSessions_.load(std::memory_order_relaxed) << " compacted from "
+              << m_compactedSegments_.load(std::memory_order_relaxed) << " segments" << std::endl;
+}
+
+size_t Server::JournalSessionSink::ScanSegment(const uint8_t* data, size_t size, const Visitor& visitor) {
+    JournalSegmentHeader header{};
+    if (size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic_ != kMagic || header.version_ != kVersion) {
+        return 0;
+    }
+    size_t position = sizeof(header);
+    uint64_t sequence = 0;
+    JournalRecord record{};
+    while (position + sizeof(record) <= size) {
+        memcpy(&record, data + position, sizeof(record));
+        if ((record.type_ != JournalRecordType::Session && record.type_ != JournalRecordType::Name)
+            || record.sequence_ != sequence) {
+            break;
+        }
+        size_t span = record.type_ == JournalRecordType::Name ? JournalNameSlots(record.duration_) * sizeof(record) : sizeof(record);
+        if (position + span > size || JournalChecksum(data + position, span) != record.checksum_) {
+            break;
+        }
+        std::string_view name;
+        if (record.type_ == JournalRecordType::Name) {
+            name = {reinterpret_cast<const char*>(data + position + offsetof(JournalRecord, name_)), record.duration_};
+        }
+        visitor(record, name);
+        position += span;
+        ++sequence;
+    }
+    return sequence;
+}
+
+bool Server::JournalSessionSink::CompactSegment(uint64_t segment) {
+    std::string path = GetSegmentPath(segment);
+    if (!m_connection_) {
+        return false;
+    }
+    if (StatementCache::Statement stmt = m_statements_.Acquire("SELECT 1 FROM JournalSegments WHERE segment = ?")) {
+        sqlite3_bind_int64(stmt, 1, static_cast<int64_t>(segment));
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            std::error_code error;
+            std::filesystem::remove(path, error);
+            return true;
+        }
+    }
+
+    MappedFile file;
+    if (!file.Open(path)) {
+        return false;
+    }
+    if (m_statements_.Execute("BEGIN IMMEDIATE") != SQLITE_OK) {
+        return false;
+    }
+    std::unordered_map<UserId_t, std::string> userNames;
+    size_t sessions = 0;
+    bool written = true;
+    ScanSegment(file.Data(), file.Size(), [&](const JournalRecord& record, std::string_view name) {
+        if (record.type_ == JournalRecordType::Name) {
+            userNames[record.userId_] = name;
+            return;
+        }
+        if (!written) {
+            return;
+        }
+        SessionRow row;
+        row.username = userNames[record.userId_];
+        row.sessionPort = record.sessionPort_;
+        row.connectTime = record.connectTime_;
+        row.disconnectTime = record.disconnectTime_;
+        row.duration = record.duration_;
+        row.day = SessionDay(record.connectTime_);
+        written = m_partitions_.Insert(row);
+        ++sessions;
+    });
+    if (StatementCache::Statement stmt = m_statements_.Acquire("INSERT INTO JournalSegments (segment, sessions, compactedAt) VALUES (?, ?, ?)")) {
+        sqlite3_bind_int64(stmt, 1, static_cast<int64_t>(segment));
+        sqlite3_bind_int64(stmt, 2, static_cast<int64_t>(sessions));
+        sqlite3_bind_int64(stmt, 3, CoarseClock::Instance().NowSeconds());
+        written = written && sqlite3_step(stmt) == SQLITE_DONE;
+    } else {
+        written = false;
+    }
+    if (!written || m_statements_.Execute("COMMIT") != SQLITE_OK) {
+        std::cerr << "Failed to compact journal segment " << segment << ": " << sqlite3_errmsg(m_connection_) << std::endl;
+        m_statements_.Execute("ROLLBACK");
+        m_partitions_.Reload();
+        return false;
+    }
+    file.Close();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+    m_compactedSessions_.fetch_add(sessions, std::memory_order_relaxed);
+    m_compactedSegments_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Server::JournalSessionSink::CompactorLoop() {
+    std::unique_lock lock(m_compactorMutex_);
+    while (m_compactorRunning_) {
+        if (m_sealedSegments_.empty()) {
+            if (int64_t today = SessionToday(); today != m_rotatedDay_ && m_connection_) {
+                lock.unlock();
+                if (m_partitions_.Rotate(today, m_retentionDays_)) {
+                    m_rotatedDay_ = today;
+                }
+                lock.lock();
+            }
+            if (int64_t now = CoarseClock::Instance().NowMilliseconds(); m_migrationPending_ && m_migrationRetry_.Ready(now)) {
+                lock.unlock();
+                int64_t moved = m_partitions_.MigrateLegacy();
+                if (moved < 0) {
+                    std::cerr << "Legacy session migration failed, retrying in " << m_migrationRetry_.Fail(now) << " ms" << std::endl;
+                } else {
+                    m_migrationRetry_.Succeed();
+                    m_migrationPending_ = static_cast<size_t>(moved) == kMigrationBatchSize;
+                    if (!m_migrationPending_) {
+                        m_rotatedDay_ = 0;
+                    }
+                }
+                lock.lock();
+            }
+            m_compactorCondition_.wait_for(lock, kWriterWindow, [this] {
+                return !m_compactorRunning_ || !m_sealedSegments_.empty();
+            });
+            continue;
+        }
+        uint64_t segment = m_sealedSegments_.front();
+        lock.unlock();
+        bool compacted = CompactSegment(segment);
+        lock.lock();
+        // A segment that fails stays on disk and is retried at the next start, rather than
+        // spinning on a failing database.
+        m_sealedSegments_.pop_front();
+        if (!compacted) {
+            std::cerr << "Journal segment " << segment << " is left for the next start." << std::endl;
+        }
+    }
+}
+
+void Server::clearUser(const std::string &username) {
+    if (UserId_t userId = m_userNames_.Find(username); userId != kInvalidUserId) {
+        m_users_.EraseUser(userId);
+    }
+}
+
+UserId_t UserNameTable::Intern(std::string_view name) {
+    {
+        std::shared_lock lock(m_mutex_);
+        if (auto it = m_ids_.find(name); it != m_ids_.end()) {
+            return it->second;
+        }
+    }
+    std::unique_lock lock(m_mutex_);
+    if (auto it = m_ids_.find(name); it != m_ids_.end()) {
+        return it->second;
+    }
+    if (m_names_.size() >= kMaxNames) {
+        return kInvalidUserId;
+    }
+    auto userId = static_cast<UserId_t>(m_names_.size());
+    const std::string& stored = m_names_.emplace_back(name);
+    m_ids_.emplace(stored, userId);
+    return userId;
+}
+
+UserId_t UserNameTable::Find(std::string_view name) const {
+    std::shared_lock lock(m_mutex_);
+    auto it = m_ids_.find(name);
+    return it == m_ids_.end() ? kInvalidUserId : it->second;
+}
+
+const std::string& UserNameTable::GetName(UserId_t id) const {
+    static const std::string kUnknownName;
+    std::shared_lock lock(m_mutex_);
+    return id < m_names_.size() ? m_names_[id] : kUnknownName;
+}
+
+size_t UserNameTable::Size() const {
+    std::shared_lock lock(m_mutex_);
+    return m_names_.size();
+}
+
+void UserNameTable::Encode(const std::vector<UserId_t>& ids, DataBuffer_t& out) const {
+    std::shared_lock lock(m_mutex_);
+    for (UserId_t id : ids) {
+        const std::string& name = id < m_names_.size() ? m_names_[id] : std::string();
+        auto length = static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX));
+        size_t offset = out.size();
+        out.resize(offset + sizeof(length) + length);
+        memcpy(out.data() + offset, &length, sizeof(length));
+        memcpy(out.data() + offset + sizeof(length), name.data(), length);
+    }
+}
+
+bool UserNameTable::Decode(const uint8_t* data, size_t size, uint32_t count, std::vector<UserId_t>& ids) {
+    ids.clear();
+    ids.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint16_t length;
+        if (size < sizeof(length)) {
+            return false;
+        }
+        memcpy(&length, data, sizeof(length));
+        if (size - sizeof(length) < length) {
+            return false;
+        }
+        UserId_t id = Intern(std::string_view(reinterpret_cast<const char*>(data + sizeof(length)), length));
+        if (id == kInvalidUserId) {
+            return false;
+        }
+        data += sizeof(length) + length;
+        size -= sizeof(length) + length;
+        ids.push_back(id);
+    }
+    return !size;
+}
+
+bool Server::UserRegistry::AddSession(const UserInfo& userInfo) {
+    Shard& shard = GetShard(userInfo.userId_);
+    std::lock_guard lock(shard.mutex);
+    auto [it, inserted] = shard.users.try_emplace(userInfo.userId_);
+    it->second.push_back(userInfo);
+    m_changes_.fetch_add(1, std::memory_order_release);
+    return inserted;
+}
+
+bool Server::UserRegistry::CloseSession(UserId_t userId, uint16_t port, int64_t disconnectTime, UserInfo& closed) {
+    Shard& shard = GetShard(userId);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it == shard.users.end()) {
+        return false;
+    }
+    auto& sessions = it->second;
+    for (auto session = sessions.begin(); session != sessions.end(); ++session) {
+        if (session->sessionPort_ == port) {
+            closed = *session;
+            closed.disconnectTime_ = disconnectTime;
+            closed.duration_ = static_cast<uint32_t>(std::max<int64_t>(disconnectTime - closed.connectTime_, 0));
+            sessions.erase(session);
+            if (sessions.empty()) {
+                shard.users.erase(it);
+            }
+            m_changes_.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Server::UserRegistry::EraseUser(UserId_t userId) {
+    Shard& shard = GetShard(userId);
+    std::lock_guard lock(shard.mutex);
+    if (shard.users.erase(userId)) {
+        m_changes_.fetch_add(1, std::memory_order_release);
+    }
+}
+
+Server::UserRegistry::Snapshot Server::UserRegistry::TakeSnapshot() const {
+    Snapshot snapshot;
+    for (const auto& shard : m_shards_) {
+        std::lock_guard lock(shard.mutex);
+        snapshot.insert(snapshot.end(), shard.users.begin(), shard.users.end());
+    }
+    return snapshot;
+}
+
+
+void Server::SessionCounters::OnConnect(uint32_t host) {
+    m_connections_.fetch_add(1, std::memory_order_relaxed);
+    Increment(m_hosts_, host);
+}
+
+void Server::SessionCounters::OnDisconnect(uint32_t host) {
+    m_connections_.fetch_sub(1, std::memory_order_relaxed);
+    Decrement(m_hosts_, host);
+}
+
+bool Server::SessionCounters::OnAuth(UserId_t userId, uint32_t limit) {
+    if (!Increment(m_users_, userId, limit)) {
+        return false;
+    }
+    m_sessions_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Server::SessionCounters::OnSessionClose(UserId_t userId) {
+    m_sessions_.fetch_sub(1, std::memory_order_relaxed);
+    Decrement(m_users_, userId);
+}
+
+void Server::SessionCounters::Reset() {
+    for (Shards* shards : {&m_users_, &m_hosts_}) {
+        for (Shard& shard : *shards) {
+            std::lock_guard lock(shard.mutex);
+            shard.counts.clear();
+        }
+    }
+    m_connections_.store(0, std::memory_order_relaxed);
+    m_sessions_.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Server::SessionCounters::Get(const Shards& shards, uint32_t key) {
+    const Shard& shard = GetShard(shards, key);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.counts.find(key);
+    return it == shard.counts.end() ? 0 : it->second;
+}
+
+uint32_t Server::SessionCounters::Increment(Shards& shards, uint32_t key, uint32_t limit) {
+    Shard& shard = GetShard(shards, key);
+    std::lock_guard lock(shard.mutex);
+    uint32_t& count = shard.counts[key];
+    if (limit && count >= limit) {
+        return 0;
+    }
+    return ++count;
+}
+
+uint32_t Server::SessionCounters::Decrement(Shards& shards, uint32_t key) {
+    Shard& shard = GetShard(shards, key);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.counts.find(key);
+    if (it == shard.counts.end()) {
+        return 0;
+    }
+    if (--it->second == 0) {
+        shard.counts.erase(it);
+        return 0;
+    }
+    return it->second;
+}
+
+PresenceState Server::PresenceService::Subscribe(InterfaceClientSession& subscriber, UserId_t userId,
+                                                 PresenceState current) {
+    std::lock_guard lock(m_mutex_);
+    auto& subscribers = m_subscribers_[userId];
+    if (std::find(subscribers.begin(), subscribers.end(), &subscriber) == subscribers.end()) {
+        subscribers.push_back(&subscriber);
+        subscriber.m_presenceSubscriptions_.push_back(userId);
+    }
+    // New subscribers start from the last published state, so a pending flap stays invisible to them too.
+    return m_published_.try_emplace(userId, current).first->second;
+}
+
+void Server::PresenceService::Unsubscribe(InterfaceClientSession& subscriber, UserId_t userId) {
+    std::lock_guard lock(m_mutex_);
+    auto& subscriptions = subscriber.m_presenceSubscriptions_;
+    subscriptions.erase(std::remove(subscriptions.begin(), subscriptions.end(), userId), subscriptions.end());
+    auto it = m_subscribers_.find(userId);
+    if (it == m_subscribers_.end()) {
+        return;
+    }
+    auto& subscribers = it->second;
+    subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), &subscriber), subscribers.end());
+    if (subscribers.empty()) {
+        m_subscribers_.erase(it);
+        m_published_.erase(userId);
+        m_pending_.erase(userId);
+    }
+}
+
+void Server::PresenceService::RemoveSubscriber(InterfaceClientSession& subscriber) {
+    std::vector<UserId_t> subscriptions;
+    {
+        std::lock_guard lock(m_mutex_);
+        subscriptions.swap(subscriber.m_presenceSubscriptions_);
+    }
+    for (UserId_t userId : subscriptions) {
+        Unsubscribe(subscriber, userId);
+    }
+}
+
+void Server::PresenceService::MarkChanged(UserId_t userId, int64_t now) {
+    std::lock_guard lock(m_mutex_);
+    if (!m_subscribers_.count(userId) || !m_pending_.try_emplace(userId, now).second) {
+        return;
+    }
+    int64_t flushAt = now + m_window_;
+    int64_t nextFlush = m_nextFlush_.load(std::memory_order_relaxed);
+    if (flushAt < nextFlush) {
+        m_nextFlush_.store(flushAt, std::memory_order_relaxed);
+    }
+}
+
+size_t Server::PresenceService::Flush(int64_t now, const SessionCounters& counters, const UserNameTable& names) {
+    if (now < m_nextFlush_.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    std::lock_guard lock(m_mutex_);
+    size_t published = 0;
+    int64_t nextFlush = INT64_MAX;
+    for (auto it = m_pending_.begin(); it != m_pending_.end();) {
+        if (now - it->second < m_window_) {
+            nextFlush = std::min(nextFlush, it->second + m_window_);
+            ++it;
+            continue;
+        }
+        UserId_t userId = it->first;
+        it = m_pending_.erase(it);
+
+        PresenceState state = counters.GetUserSessionCount(userId) ? PresenceState::Online : PresenceState::Offline;
+        PresenceState& last = m_published_.try_emplace(userId, PresenceState::Offline).first->second;
+        if (last == state) {
+            m_suppressedCount_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        last = state;
+
+        PresenceRecord record;
+        record.user_ = names.GetName(userId);
+        record.state_ = state;
+        record.changedAt_ = now / 1000;
+        std::shared_ptr<DataBuffer_t> frame = BufferPool::Instance().AcquireShared(sizeof(uint32_t));
+        if (!PresenceSchema::Encode(record, *frame)) {
+            continue;
+        }
+        uint32_t header = MakeFrameHeader(FrameType::Presence, static_cast<uint32_t>(frame->size() - sizeof(header)));
+        memcpy(frame->data(), &header, sizeof(header));
+        for (InterfaceClientSession* subscriber : m_subscribers_[userId]) {
+            if (!subscriber->QueuePresence(frame)) {
+                m_droppedCount_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        m_publishedCount_.fetch_add(1, std::memory_order_relaxed);
+        ++published;
+    }
+    m_nextFlush_.store(nextFlush, std::memory_order_relaxed);
+    return published;
+}
+
+Server::SessionLog::SessionLog(size_t capacity) {
+    size_t roundedCapacity = 2;
+    while (roundedCapacity < capacity) {
+        roundedCapacity <<= 1;
+    }
+    m_cells_.reset(new Cell[roundedCapacity]);
+    m_mask_ = roundedCapacity - 1;
+    for (size_t i = 0; i < roundedCapacity; ++i) {
+        m_cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool Server::SessionLog::Push(const SessionEvent& event) {
+    size_t position = m_enqueuePosition_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &m_cells_[position & m_mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (m_enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            m_overflows_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = m_enqueuePosition_.load(std::memory_order_relaxed);
+        }
+    }
+    cell->event = event;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool Server::SessionLog::Pop(SessionEvent& event) {
+    size_t position = m_dequeuePosition_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &m_cells_[position & m_mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+        if (difference == 0) {
+            if (m_dequeuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = m_dequeuePosition_.load(std::memory_order_relaxed);
+        }
+    }
+    event = cell->event;
+    cell->sequence.store(position + m_mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+size_t Server::SessionLog::GetSize() const {
+    size_t enqueued = m_enqueuePosition_.load(std::memory_order_relaxed);
+    size_t dequeued = m_dequeuePosition_.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+void Server::PushSessionEvent(SessionEventType type, uint32_t host, const UserInfo& session) {
+    SessionEvent event;
+    event.type_ = type;
+    event.host_ = host;
+    event.session_ = session;
+    if (m_sessionLog_.Push(event)) {
+        size_t depth = m_sessionLog_.GetSize();
+        size_t peak = m_sessionQueuePeak_.load(std::memory_order_relaxed);
+        while (depth > peak && !m_sessionQueuePeak_.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+        if (depth == kWriterBatchSize) {
+            m_writerCondition_.notify_one();
+        }
+        return;
+    }
+    // Only finished sessions are persisted, so nothing else needs to survive an overflow.
+    if (type == SessionEventType::Disconnect && session.userId_ != kInvalidUserId) {
+        SpillSession(session);
+    }
+}
+
+bool Server::SpillSession(const UserInfo& session) {
+    SessionLogRecord record;
+    record.connectTime_ = session.connectTime_;
+    record.disconnectTime_ = session.disconnectTime_;
+    record.duration_ = session.duration_;
+    record.sessionPort_ = session.sessionPort_;
+    record.user_ = m_userNames_.GetName(session.userId_);
+    record.password_ = session.password_;
+    if (!m_spool_.Append(record)) {
+        m_droppedSessions_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+size_t Server::FlushSessionLog() {
+    std::lock_guard lock(m_sinkMutex_);
+    size_t written = 0;
+    SessionEvent event;
+    bool drained = false;
+    while (!drained && m_sessionLog_.GetSize()) {
+        // Nothing is popped until the batch has a transaction, so a failed BEGIN leaves the events
+        // in the ring for the next round; if it fills up meanwhile, they overflow to the spool.
+        if (!m_sink_->Begin()) {
+            m_failedBatches_.fetch_add(1, std::memory_order_relaxed);
+            return written;
+        }
+        size_t batch = 0;
+        m_writerBatch_.clear();
+        while (batch < kWriterBatchSize && !(drained = !m_sessionLog_.Pop(event))) {
+            if (event.type_ != SessionEventType::Disconnect || event.session_.userId_ == kInvalidUserId) {
+                continue;
+            }
+            // A row the sink refuses is spooled rather than lost with the rest of the batch.
+            if (m_sink_->Write(event.session_, m_userNames_)) {
+                m_writerBatch_.push_back(std::move(event.session_));
+            } else {
+                SpillSession(event.session_);
+            }
+            ++batch;
+        }
+        // A rolled back batch goes to the spool and is retried once the sink works again.
+        if (!m_sink_->Commit()) {
+            m_failedBatches_.fetch_add(1, std::memory_order_relaxed);
+            for (const UserInfo& session : m_writerBatch_) {
+                SpillSession(session);
+            }
+            return written;
+        }
+        m_writtenSessions_.fetch_add(m_writerBatch_.size(), std::memory_order_relaxed);
+        if (!m_writerBatch_.empty()) {
+            m_writerCommits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        written += m_writerBatch_.size();
+    }
+
+    // The sink has caught up with the ring; read back what overflowed, until new work piles up.
+    while (m_sessionLog_.GetSize() < kWriterBatchSize && m_spool_.GetPendingCount()) {
+        if (!m_sink_->Begin()) {
+            m_failedBatches_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        m_spool_.Read(m_spoolBatch_, kWriterBatchSize);
+        const auto requeue = [this](const SessionLogRecord& record) {
+            if (!m_spool_.Append(record)) {
+                m_droppedSessions_.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+        // Written records are moved to the front; the rest go straight back to the spool.
+        size_t accepted = 0;
+        for (size_t i = 0; i < m_spoolBatch_.size(); ++i) {
+            const SessionLogRecord& record = m_spoolBatch_[i];
+            UserInfo session(m_userNames_.Intern(record.user_), record.sessionPort_, record.connectTime_,
+                             record.disconnectTime_, record.duration_);
+            session.password_ = record.password_;
+            if (session.userId_ != kInvalidUserId && m_sink_->Write(session, m_userNames_)) {
+                std::swap(m_spoolBatch_[accepted++], m_spoolBatch_[i]);
+            } else {
+                requeue(record);
+            }
+        }
+        if (!m_sink_->Commit()) {
+            m_failedBatches_.fetch_add(1, std::memory_order_relaxed);
+            for (size_t i = 0; i < accepted; ++i) {
+                requeue(m_spoolBatch_[i]);
+            }
+            break;
+        }
+        m_writtenSessions_.fetch_add(accepted, std::memory_order_relaxed);
+        if (accepted) {
+            m_writerCommits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        written += accepted;
+        // Stop once a batch brings back records the sink still refuses, or they would cycle here.
+        if (accepted < m_spoolBatch_.size() || m_spoolBatch_.empty()) {
+            break;
+        }
+    }
+    return written;
+}
+
+Server::SessionSpool::~SessionSpool() {
+    FlushAppended();
+    if (m_file_) {
+        std::fclose(m_file_);
+    }
+}
+
+void Server::SessionSpool::SetPath(std::string path) {
+    std::lock_guard lock(m_fileMutex_);
+    if (m_file_) {
+        std::fclose(m_file_);
+        m_file_ = nullptr;
+        m_pending_.fetch_sub(m_filePending_, std::memory_order_relaxed);
+        m_filePending_ = 0;
+    }
+    m_path_ = std::move(path);
+}
+
+bool Server::SessionSpool::Open() {
+    std::lock_guard lock(m_fileMutex_);
+    return OpenLocked();
+}
+
+bool Server::SessionSpool::OpenLocked() {
+    if (m_file_) {
+        return true;
+    }
+    m_file_ = std::fopen(m_path_.c_str(), "r+b");
+    if (!m_file_) {
+        m_file_ = std::fopen(m_path_.c_str(), "w+b");
+        if (!m_file_) {
+            return false;
+        }
+    }
+    // Count what a previous run left behind; a torn last record is cut off.
+    m_readOffset_ = 0;
+    m_writeOffset_ = 0;
+    uint64_t pending = 0;
+    uint32_t length;
+    std::fseek(m_file_, 0, SEEK_END);
+    long size = std::ftell(m_file_);
+    while (m_writeOffset_ + static_cast<long>(sizeof(length)) <= size) {
+        std::fseek(m_file_, m_writeOffset_, SEEK_SET);
+        if (std::fread(&length, sizeof(length), 1, m_file_) != 1 || length > BinaryLogSessionSink::kMaxRecordSize
+            || m_writeOffset_ + static_cast<long>(sizeof(length) + length) > size) {
+            break;
+        }
+        m_writeOffset_ += static_cast<long>(sizeof(length) + length);
+        ++pending;
+    }
+    m_filePending_ = pending;
+    m_pending_.fetch_add(pending, std::memory_order_relaxed);
+    if (!pending) {
+        ResetLocked();
+    }
+    return m_file_ != nullptr;
+}
+
+void Server::SessionSpool::ResetLocked() {
+    m_file_ = std::freopen(m_path_.c_str(), "w+b", m_file_);
+    m_readOffset_ = 0;
+    m_writeOffset_ = 0;
+}
+
+bool Server::SessionSpool::Append(const SessionLogRecord& record) {
+    DataBuffer_t full;
+    uint64_t count;
+    {
+        std::lock_guard lock(m_mutex_);
+        size_t offset = m_appended_.size();
+        m_appended_.resize(offset + sizeof(uint32_t));
+        if (!SessionLogRecordSchema::Encode(record, m_appended_)) {
+            m_appended_.resize(offset);
+            return false;
+        }
+        auto length = static_cast<uint32_t>(m_appended_.size() - offset - sizeof(uint32_t));
+        memcpy(m_appended_.data() + offset, &length, sizeof(length));
+        ++m_appendedCount_;
+        m_pending_.fetch_add(1, std::memory_order_relaxed);
+        m_spilled_.fetch_add(1, std::memory_order_relaxed);
+        m_spilledBytes_.fetch_add(m_appended_.size() - offset, std::memory_order_relaxed);
+        if (m_appended_.size() < kAppendBufferSize) {
+            return true;
+        }
+        full.swap(m_appended_);
+        count = std::exchange(m_appendedCount_, 0);
+    }
+    WriteOut(full, count);
+    return true;
+}
+
+void Server::SessionSpool::FlushAppended() {
+    DataBuffer_t appended;
+    uint64_t count;
+    {
+        std::lock_guard lock(m_mutex_);
+        appended.swap(m_appended_);
+        count = std::exchange(m_appendedCount_, 0);
+    }
+    if (count) {
+        WriteOut(appended, count);
+    }
+}
+
+// Sessions that cannot be written are counted as lost; they are no longer pending.
+void Server::SessionSpool::WriteOut(const DataBuffer_t& buffer, uint64_t records) {
+    std::lock_guard lock(m_fileMutex_);
+    if (!OpenLocked() || std::fseek(m_file_, m_writeOffset_, SEEK_SET) != 0
+        || std::fwrite(buffer.data(), 1, buffer.size(), m_file_) != buffer.size()
+        || std::fflush(m_file_) != 0) {
+        std::cerr << "Can't write " << records << " sessions to spool " << m_path_ << std::endl;
+        // A partial write is overwritten by the next one.
+        m_pending_.fetch_sub(records, std::memory_order_relaxed);
+        m_lost_.fetch_add(records, std::memory_order_relaxed);
+        return;
+    }
+    m_writeOffset_ += static_cast<long>(buffer.size());
+    m_filePending_ += records;
+}
+
+size_t Server::SessionSpool::Read(std::vector<SessionLogRecord>& records, size_t limit) {
+    records.clear();
+    if (!m_pending_.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    FlushAppended();
+    std::lock_guard lock(m_fileMutex_);
+    if (!OpenLocked() || std::fseek(m_file_, m_readOffset_, SEEK_SET) != 0) {
+        return 0;
+    }
+    uint32_t length;
+    uint64_t consumed = 0;
+    while (consumed < limit && m_readOffset_ < m_writeOffset_
+           && std::fread(&length, sizeof(length), 1, m_file_) == 1) {
+        if (length > BinaryLogSessionSink::kMaxRecordSize) {
+            m_readOffset_ = m_writeOffset_;
+            break;
+        }
+        m_buffer_.resize(length);
+        m_readOffset_ += static_cast<long>(sizeof(length) + length);
+        ++consumed;
+        if (std::fread(m_buffer_.data(), 1, length, m_file_) != length) {
+            break;
+        }
+        records.emplace_back();
+        if (!SessionLogRecordSchema::Decode(m_buffer_, records.back())) {
+            records.pop_back();
+        }
+    }
+    if (m_readOffset_ >= m_writeOffset_) {
+        consumed = m_filePending_;
+        ResetLocked();
+    }
+    m_filePending_ -= consumed;
+    m_pending_.fetch_sub(consumed, std::memory_order_relaxed);
+    m_drained_.fetch_add(records.size(), std::memory_order_relaxed);
+    return records.size();
+}
+
+void Server::WakeSessionWriter() {
+    {
+        std::lock_guard lock(m_writerMutex_);
+        m_writerWakeRequested_ = true;
+    }
+    m_writerCondition_.notify_one();
+}
+
+void Server::StartSessionWriter() {
+    std::lock_guard lock(m_writerMutex_);
+    if (m_writerRunning_) {
+        return;
+    }
+    m_writerRunning_ = true;
+    m_spool_.Open();
+    m_writerThread_ = std::thread(&Server::SessionWriterLoop, this);
+}
+
+void Server::StopSessionWriter() {
+    {
+        std::lock_guard lock(m_writerMutex_);
+        if (!m_writerRunning_) {
+            return;
+        }
+        m_writerRunning_ = false;
+    }
+    m_writerCondition_.notify_all();
+    if (m_writerThread_.joinable()) {
+        m_writerThread_.join();
+    }
+    FlushSessionLog();
+    std::lock_guard lock(m_sinkMutex_);
+    m_sink_->Sync();
+}
+
+void Server::SessionWriterLoop() {
+    std::unique_lock lock(m_writerMutex_);
+    while (m_writerRunning_) {
+        m_writerCondition_.wait_for(lock, kWriterWindow, [this] {
+            return !m_writerRunning_ || m_writerWakeRequested_ || m_sessionLog_.GetSize() >= kWriterBatchSize;
+        });
+        m_writerWakeRequested_ = false;
+        lock.unlock();
+        FlushSessionLog();
+        {
+            std::lock_guard sinkLock(m_sinkMutex_);
+            m_sink_->Maintain();
+        }
+        lock.lock();
+    }
+}
+
+static uint64_t SnapshotChecksum(const Server::SnapshotHeader& header, const uint8_t* body) {
+    Server::SnapshotHeader unsealed = header;
+    unsealed.checksum_ = 0;
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+    };
+    mix(reinterpret_cast<const uint8_t*>(&unsealed), sizeof(unsealed));
+    mix(body, header.bodySize_);
+    return hash;
+}
+
+bool Server::WriteSnapshot() {
+    std::lock_guard lock(m_snapshotWriteMutex_);
+
+    // Sessions first, each naming its user by position in the name list that follows. Only users
+    // with open sessions are listed, so the image grows with the sessions, not with the name table.
+    DataBuffer_t& body = m_snapshotBuffer_;
+    if (uint64_t changes = m_users_.GetChangeCount(); changes != m_snapshotChanges_) {
+        body.clear();
+        std::vector<UserId_t> users;
+        uint32_t sessionCount = 0;
+        for (const auto& [userId, sessions] : m_users_.TakeSnapshot()) {
+            for (const UserInfo& session : sessions) {
+                SnapshotSession record{static_cast<UserId_t>(users.size()), session.sessionPort_, 0, session.connectTime_};
+                size_t offset = body.size();
+                body.resize(offset + sizeof(record));
+                memcpy(body.data() + offset, &record, sizeof(record));
+                ++sessionCount;
+            }
+            users.push_back(userId);
+        }
+        m_userNames_.Encode(users, body);
+        m_snapshotChanges_ = changes;
+        m_snapshotCurrentSlots_ = 0;
+        m_snapshotSessionCount_ = sessionCount;
+        m_snapshotNameCount_ = static_cast<uint32_t>(users.size());
+    }
+
+    SnapshotHeader header{};
+    header.magic_ = SnapshotHeader::kMagic;
+    header.version_ = SnapshotHeader::kVersion;
+    header.sequence_ = ++m_snapshotSequence_;
+    header.takenAt_ = CoarseClock::Instance().NowSeconds();
+    header.sessionCount_ = m_snapshotSessionCount_;
+    header.nameCount_ = m_snapshotNameCount_;
+    header.bodySize_ = body.size();
+    header.checksum_ = SnapshotChecksum(header, body.data());
+
+    size_t required = sizeof(header) + body.size();
+    bool grown = false;
+    if (m_snapshotFile_.Size() / 2 < required) {
+        size_t slotSize = kSnapshotMinSlotSize;
+        while (slotSize < required) {
+            slotSize <<= 1;
+        }
+        if (!m_snapshotFile_.Open(m_snapshotPath_, slotSize * 2)) {
+            return false;
+        }
+        grown = true;
+        m_snapshotCurrentSlots_ = 0;
+    }
+
+    // A grown file moves the slot boundary, so both slots are rewritten to keep a valid spare.
+    // Once both slots hold the current body, only the header is written.
+    size_t slotSize = m_snapshotFile_.Size() / 2;
+    for (size_t slot = header.sequence_ & 1, writes = grown ? 2 : 1; writes--; slot ^= 1) {
+        uint8_t* target = m_snapshotFile_.Data() + slot * slotSize;
+        if (m_snapshotCurrentSlots_ < 2) {
+            memcpy(target + sizeof(header), body.data(), body.size());
+            ++m_snapshotCurrentSlots_;
+        }
+        memcpy(target, &header, sizeof(header));
+    }
+    return m_snapshotFile_.Flush();
+}
+
+size_t Server::RestoreSnapshot() {
+    MappedFile file;
+    if (!file.Open(m_snapshotPath_)) {
+        return 0;
+    }
+
+    size_t slotSize = file.Size() / 2;
+    SnapshotHeader header{};
+    const uint8_t* body = nullptr;
+    for (size_t slot = 0; slot < 2; ++slot) {
+        const uint8_t* data = file.Data() + slot * slotSize;
+        SnapshotHeader candidate;
+        memcpy(&candidate, data, sizeof(candidate));
+        if (candidate.magic_ != SnapshotHeader::kMagic || candidate.version_ != SnapshotHeader::kVersion
+            || candidate.bodySize_ > slotSize - sizeof(candidate)
+            || candidate.sessionCount_ > candidate.bodySize_ / sizeof(SnapshotSession)
+            || candidate.checksum_ != SnapshotChecksum(candidate, data + sizeof(candidate))
+            || (body && candidate.sequence_ < header.sequence_)) {
+            continue;
+        }
+        header = candidate;
+        body = data + sizeof(candidate);
+    }
+    if (!body) {
+        return 0;
+    }
+
+    size_t sessionsSize = header.sessionCount_ * sizeof(SnapshotSession);
+    std::vector<UserId_t> ids;
+    if (!m_userNames_.Decode(body + sessionsSize, header.bodySize_ - sessionsSize, header.nameCount_, ids)) {
+        return 0;
+    }
+
+    // The clients behind these sessions are gone; close them at the last moment they were known to be alive.
+    for (uint32_t i = 0; i < header.sessionCount_; ++i) {
+        SnapshotSession record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        if (record.userId_ >= ids.size()) {
+            continue;
+        }
+        uint32_t duration = static_cast<uint32_t>(std::max<int64_t>(header.takenAt_ - record.connectTime_, 0));
+        PushSessionEvent(SessionEventType::Disconnect, 0,
+                         UserInfo(ids[record.userId_], record.sessionPort_, record.connectTime_, header.takenAt_, duration));
+    }
+    m_snapshotSequence_ = header.sequence_;
+    file.Close();
+
+    size_t restored = FlushSessionLog();
+    WriteSnapshot();
+    return restored;
+}
+
+void Server::StartSnapshotLoop() {
+    std::lock_guard lock(m_snapshotMutex_);
+    if (m_snapshotRunning_) {
+        return;
+    }
+    m_snapshotRunning_ = true;
+    m_snapshotThread_ = std::thread(&Server::SnapshotLoop, this);
+}
+
+void Server::StopSnapshotLoop() {
+    {
+        std::lock_guard lock(m_snapshotMutex_);
+        if (!m_snapshotRunning_) {
+            return;
+        }
+        m_snapshotRunning_ = false;
+    }
+    m_snapshotCondition_.notify_all();
+    if (m_snapshotThread_.joinable()) {
+        m_snapshotThread_.join();
+    }
+    WriteSnapshot();
+}
+
+void Server::SnapshotLoop() {
+    std::unique_lock lock(m_snapshotMutex_);
+    while (m_snapshotRunning_) {
+        lock.unlock();
+        WriteSnapshot();
+        lock.lock();
+        m_snapshotCondition_.wait_for(lock, kSnapshotInterval, [this]{return !m_snapshotRunning_;});
+    }
+}
+
+Server::InterfaceClientSession::InterfaceClientSession(SocketHandle_t socket, SocketAddressIn_t address)
+        : m_address_(address), m_socketDescriptor_(socket){
+    SetFirstConnectionTime();
+}
+
+
+Server::InterfaceClientSession::~InterfaceClientSession(){
+    InterfaceClientSession::Disconnect();
+#ifdef _WIN32
+    if(m_socketDescriptor_ == INVALID_SOCKET) {
+        return;
+    }
+    shutdown(m_socketDescriptor_, SD_BOTH);
+    closesocket(m_socketDescriptor_);
+#else
+    if(m_socketDescriptor_ == -1) {
+        return;
+    }
+    shutdown(m_socketDescriptor_, SD_BOTH);
+    close(m_socketDescriptor_);
+#endif
+}
+
+TCPInterfaceBase::SockStatusInfo_t Server::InterfaceClientSession::Disconnect() {
+    SetLastDisconnectionTime();
+    m_connectionStatus_ = SockStatusInfo_t::Disconnected;
+#ifdef _WIN32
+    if (m_socketDescriptor_ == INVALID_SOCKET) {
+        return m_connectionStatus_;
+    }
+    shutdown(m_socketDescriptor_, SD_BOTH);
+    closesocket(m_socketDescriptor_);
+    m_socketDescriptor_ = INVALID_SOCKET;
+#else
+    if (m_socketDescriptor_ == -1) {
+        return m_connectionStatus_;
+    }
+    shutdown(m_socketDescriptor_, SD_BOTH);
+    close(m_socketDescriptor_);
+    m_socketDescriptor_ = -1;
+#endif
+    SetLastDisconnectionTime();
+    return m_connectionStatus_;
+}
+
+bool Server::InterfaceClientSession::SendData(const void *buffer, const size_t size) const {
+    return SendFrame(FrameType::Data, buffer, size);
+}
+
+bool Server::InterfaceClientSession::SendFrame(FrameType type, const void *buffer, const size_t size) const {
+    if(m_connectionStatus_ != SocketStatusInfo::Connected || size > kFrameLengthMask) {
+        return false;
+    }
+    DataBuffer_t sendBuffer = BufferPool::Instance().Acquire(size + sizeof (uint32_t));
+    memcpy(sendBuffer.data() + sizeof (uint32_t ), buffer, size);
+    *reinterpret_cast<uint32_t*>(sendBuffer.data()) = MakeFrameHeader(type, static_cast<uint32_t>(size));
+    std::unique_lock lock(m_sendMutex_);
+    bool isSent = SendExact(m_socketDescriptor_, sendBuffer.data(), sendBuffer.size());
+    lock.unlock();
+    BufferPool::Instance().Release(std::move(sendBuffer));
+    return isSent;
+}
+
+bool Server::InterfaceClientSession::SendEncodedFrame(const DataBuffer_t& frame, std::chrono::milliseconds timeout) const {
+    if (m_connectionStatus_ != SocketStatusInfo::Connected) {
+        return false;
+    }
+    std::lock_guard lock(m_sendMutex_);
+    return SendExact(m_socketDescriptor_, frame.data(), frame.size(), timeout);
+}
+
+bool Server::InterfaceClientSession::QueuePresence(std::shared_ptr<const DataBuffer_t> frame) {
+    std::lock_guard lock(m_presenceMutex_);
+    if (m_presenceQueue_.size() >= kMaxPresenceQueue) {
+        return false;
+    }
+    m_presenceQueue_.push_back(std::move(frame));
+    m_presencePending_.store(true, std::memory_order_release);
+    return true;
+}
+
+// A frame cut short by the timeout would leave the stream out of sync, so a subscriber that falls
+// behind is disconnected rather than skipped.
+void Server::InterfaceClientSession::SendQueuedPresence() {
+    std::deque<std::shared_ptr<const DataBuffer_t>> frames;
+    {
+        std::lock_guard lock(m_presenceMutex_);
+        frames.swap(m_presenceQueue_);
+    }
+    for (const auto& frame : frames) {
+        if (!SendEncodedFrame(*frame, kPresenceSendTimeout)) {
+            Disconnect();
+            return;
+        }
+    }
+}
+
+DataBuffer_t Server::InterfaceClientSession::LoadData() {
+    static const FrameLimits kDefaultLimits;
+    if (Frame frame = LoadFrame(kDefaultLimits); frame.type == FrameType::Data && frame.error == ProtocolError::None) {
+        return std::move(frame.payload);
+    }
+    return DataBuffer_t();
+}
+
+Frame Server::InterfaceClientSession::LoadFrame(const FrameLimits& limits, bool as_view) {
+    if (m_connectionStatus_ != SocketStatusInfo::Connected) {
+        return Frame();
+    }
+    Frame frame;
+    uint32_t header;
+    int error = 0;
+#ifdef _WIN32
+    if (u_long t = true; SOCKET_ERROR == ioctlsocket(m_socketDescriptor_, FIONBIO, &t)) {
+        return Frame();
+    }
+    int answer = recv(m_socketDescriptor_, (char *)&header, sizeof(header), 0);
+    if (u_long t = false; SOCKET_ERROR == ioctlsocket(m_socketDescriptor_, FIONBIO, &t)){
+        return Frame();
+    }
+#else
+    int answer = recv(m_socketDescriptor_, (char *)&header, sizeof(header), MSG_DONTWAIT);
+#endif
+    if (!answer) {
+        Disconnect();
+        return Frame();
+    } else if (answer == -1) {
+        WIN (
+                error = convertError();
+                if (!error) {
+                    SocketLength_t length = sizeof (error);
+                    getsockopt(m_socketDescriptor_, SOL_SOCKET, SO_ERROR, WIN((char*))&error, &length);
+                }
+        )
+        NIX (
+                SocketLength_t length = sizeof (error);
+                getsockopt(m_socketDescriptor_, SOL_SOCKET, SO_ERROR, WIN((char*))&error, &length);
+                if (!error) {
+                    error = errno;
+                }
+        )
+    } else if (answer < static_cast<int>(sizeof(header))
+               && !ReceiveExact(m_socketDescriptor_, reinterpret_cast<char*>(&header) + answer, sizeof(header) - answer)) {
+        Disconnect();
+        return Frame();
+    }
+
+    switch (error) {
+        case 0:
+            break;
+        case ETIMEDOUT:
+        case ECONNRESET:
+        case EPIPE:
+            Disconnect();
+            [[fallthrough]];
+        case EAGAIN:
+            return Frame();
+        default:
+            Disconnect();
+            std::cerr << "Unhandled error!\n"
+                      << "Code: " << error << " Error: " << std::strerror(error) << '\n';
+            return Frame();
+    }
+
+    if (ProtocolError error = limits.Validate(header); error != ProtocolError::None) {
+        RejectFrame(error);
+        frame.error = error;
+        return frame;
+    }
+
+    uint32_t size = GetFrameLength(header);
+    if (!size) {
+        return Frame();
+    }
+
+    frame.type = GetFrameType(header);
+    if (as_view && frame.type == FrameType::Data) {
+        frame.view = ReceiveView(size);
+        return frame;
+    }
+    frame.payload = BufferPool::Instance().Acquire(size);
+    if (!ReceiveExact(m_socketDescriptor_, frame.payload.data(), frame.payload.size())) {
+        int err = errno;
+        std::cerr << "Error receiving data: " << std::strerror(err) << '\n';
+        Disconnect();
+        return Frame();
+    }
+
+    return frame;
+}
+
+void Server::InterfaceClientSession::RejectFrame(ProtocolError error) {
+    SendFrame(FrameType::Error, &error, sizeof(error));
+    Disconnect();
+}
+
+DataView Server::InterfaceClientSession::ReceiveView(size_t size) {
+    if (!m_receiveBuffer_ || m_receiveBuffer_->leased_.load(std::memory_order_acquire)) {
+        m_receiveBuffer_ = std::make_shared<ReceiveBuffer>();
+        m_receiveBuffer_->data = BufferPool::Instance().Acquire(size);
+    }
+    m_receiveBuffer_->data.resize(size);
+    if (!ReceiveExact(m_socketDescriptor_, m_receiveBuffer_->data.data(), size)) {
+        int err = errno;
+        std::cerr << "Error receiving data: " << std::strerror(err) << '\n';
+        Disconnect();
+        return DataView();
+    }
+    m_receiveBuffer_->leased_.store(true, std::memory_order_relaxed);
+    std::shared_ptr<const DataBuffer_t> lease(&m_receiveBuffer_->data, [buffer = m_receiveBuffer_](const DataBuffer_t*) {
+        buffer->leased_.store(false, std::memory_order_release);
+    });
+    return DataView(std::move(lease), 0, size);
+}
+
+bool Server::InterfaceClientSession::PushStreamChunk(StreamChunk chunk) {
+    std::lock_guard lock(m_streamMutex_);
+    if (m_streamWindows_.size() >= kMaxStreams && !m_streamWindows_.count(chunk.streamId)) {
+        return false;
+    }
+    auto [window, inserted] = m_streamWindows_.try_emplace(chunk.streamId, kStreamInitialWindow);
+    if ((inserted && !chunk.IsBegin()) || chunk.Size() > window->second) {
+        m_streamWindows_.erase(window);
+        return false;
+    }
+    window->second -= static_cast<uint32_t>(chunk.Size());
+    if (chunk.IsEnd()) {
+        m_streamWindows_.erase(window);
+    }
+    m_pendingChunks_.push_back(std::move(chunk));
+    return true;
+}
+
+bool Server::InterfaceClientSession::PopStreamChunk(StreamChunk& chunk) {
+    std::lock_guard lock(m_streamMutex_);
+    if (m_pendingChunks_.empty()) {
+        return false;
+    }
+    chunk = std::move(m_pendingChunks_.front());
+    m_pendingChunks_.pop_front();
+    return true;
+}
+
+void Server::InterfaceClientSession::ReleaseStreamWindow(uint32_t stream_id, uint32_t credit) {
+    if (!credit) {
+        return;
+    }
+    {
+        std::lock_guard lock(m_streamMutex_);
+        auto window = m_streamWindows_.find(stream_id);
+        if (window == m_streamWindows_.end()) {
+            return;
+        }
+        window->second += credit;
+    }
+    DataBuffer_t update = MakeStreamWindow(stream_id, credit);
+    SendFrame(FrameType::StreamWindow, update.data(), update.size());
+}
+
+uint32_t Server::InterfaceClientSession::GetHost() const {
+    return
+            WIN (
+                    m_address_.sin_addr.S_un.S_addr
+            )
+            NIX (
+                    m_address_.sin_addr.s_addr
+            );
+}
+
+uint16_t Server::InterfaceClientSession::GetPort() const {
+    return m_address_.sin_port;
+}
+
+uint32_t Server::InterfaceClientSession::ConnectionDuration(const InterfaceClientSession& client) {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+            client.GetLastDisconnectionTime() - client.GetFirstConnectionTime()).count());
+}
+
+
+
+bool Server::InterfaceClientSession::AutentficateUserInfo(const DataBuffer_t& data,Server::InterfaceClientSession& client, Server& server) {
+    uint16_t port = client.GetPort();
+    int64_t connectionTime = ToEpochSeconds(client.GetFirstConnectionTime());
+
+    std::string_view receivedMessage(reinterpret_cast<const char*>(data.data()), data.size());
+    std::string strippedMessage;
+    if (receivedMessage.find('\0') != std::string_view::npos) {
+        strippedMessage.assign(receivedMessage);
+        strippedMessage.erase(std::remove(strippedMessage.begin(), strippedMessage.end(), '\0'), strippedMessage.end());
+        receivedMessage = strippedMessage;
+    }
+
+    size_t colonPos = receivedMessage.find(':');
+    if (colonPos == std::string::npos){
+        /*std::cerr << "User don`t detected" << std::endl;*/
+        return false;
+    }
+    std::string_view username = receivedMessage.substr(0, colonPos);
+    if (username.empty()) {
+        return false;
+    }
+
+    // A connection holds one session: repeating the login keeps it, logging in as someone else closes it.
+    // Names are only interned once the login is admitted, so rejected peers leave nothing in the table.
+    UserId_t userId = server.m_userNames_.Find(username);
+    UserId_t previousId = client.m_userId_;
+    if (userId != kInvalidUserId && previousId == userId) {
+        return true;
+    }
+    if (userId == kInvalidUserId) {
+        userId = server.m_userNames_.Intern(username);
+    }
+    if (userId == kInvalidUserId || !server.m_counters_.OnAuth(userId, server.m_admission_.maxSessionsPerUser)) {
+        server.m_admissionRejected_[static_cast<size_t>(AdmissionLimit::UserSessions)].fetch_add(1, std::memory_order_relaxed);
+        client.RejectFrame(ProtocolError::AdmissionRejected);
+        return false;
+    }
+    // The first user's session runs from the connection; a later one starts at its own login.
+    if (previousId != kInvalidUserId) {
+        UserInfo closed;
+        connectionTime = CoarseClock::Instance().NowSeconds();
+        if (server.m_users_.CloseSession(previousId, port, connectionTime, closed)) {
+            server.PushSessionEvent(SessionEventType::Disconnect, client.GetHost(), closed);
+        }
+        server.m_counters_.OnSessionClose(previousId);
+        server.m_presence_.MarkChanged(previousId, CoarseClock::Instance().NowMilliseconds());
+    }
+    client.m_userId_ = userId;
+    client.m_userName_ = &server.m_userNames_.GetName(userId);
+    client.m_userBucket_.store(server.m_rateLimiter_.GetUserBucket(userId), std::memory_order_release);
+    server.m_presence_.MarkChanged(userId, CoarseClock::Instance().NowMilliseconds());
+
+    UserInfo session(userId, port, connectionTime);
+    session.password_ = receivedMessage.substr(colonPos + 1);
+    if (server.m_users_.AddSession(session)) {
+        std::cout << "User '" << username << "' has been assigned port: " << client.GetPort() << std::endl;
+    }
+    else {
+        std::cout << "User '" << username << "' authenticated successfully" << std::endl;
+    }
+    return true;
+}
+
+void Server::InterfaceClientSession::OnDisconnect(const InterfaceClientSession& client, Server& server) {
+    UserId_t userId = client.GetUserId();
+    int64_t lastConnection = ToEpochSeconds(client.GetLastDisconnectionTime());
+
+    UserInfo closed;
+    if (userId != kInvalidUserId && server.m_users_.CloseSession(userId, client.GetPort(), lastConnection, closed)) {
+        server.PushSessionEvent(SessionEventType::Disconnect, client.GetHost(), closed);
+    }
+}
+
+void Server::InterfaceClientSession::WriteToDB(const InterfaceClientSession&, Server& server) {
+    server.WakeSessionWriter();
+}
+
+std::string Server::InterfaceClientSession::GetDayNow() {
+    return CoarseClock::Instance().DateNow();
 }
 
 std::string Server::InterfaceClientSession::GetConnectionTime() {
-    std::chrono::system_clock::time_point timeConnection = GetFirstConnectionTime();
-    std::time_t t = std::chrono::system_clock::to_time_t(timeConnection);
-    char buft[80];
-    std::strftime(buft, sizeof(buft), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
-    return std::string{buft};
+    return FormatDateTime(ToEpochSeconds(GetFirstConnectionTime()));
 }
 
 std::string Server::InterfaceClientSession::GetDisconnectionTime() {
-    std::chrono::system_clock::time_point timeConnection = GetLastDisconnectionTime();
-    std::time_t t = std::chrono::system_clock::to_time_t(timeConnection);
-    char buft[80];
-    std::strftime(buft, sizeof(buft), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+    return FormatDateTime(ToEpochSeconds(GetLastDisconnectionTime()));
+}
+
+std::string Server::FormatDate(int64_t epoch) {
+    return CoarseClock::Instance().FormatDate(epoch);
+}
+
+std::string Server::FormatDateTime(int64_t epoch) {
+    return CoarseClock::Instance().FormatDateTime(epoch);
+}
+
+std::string Server::FormatDuration(uint32_t duration) {
+    char buft[16];
+    snprintf(buft, sizeof(buft), "%02u:%02u:%02u", duration / 3600, duration / 60 % 60, duration % 60);
     return std::string{buft};
 }
 
@@ -758,13 +2579,11 @@ ServerKeepAliveConfig::ServerKeepAliveConfig(KeepAliveProperty_t idle,
                                                     count_(count)
                                                {}
 
-Server::UserInfo::UserInfo(std::string username, std::string pass, uint16_t port, std::string connectTime,
-                           std::string disconnectTime, std::string duration, std::string timeToday)
-        : username_(std::move(username)),
-          password_(std::move(pass)),
+Server::UserInfo::UserInfo(UserId_t userId, uint16_t port, int64_t connectTime,
+                           int64_t disconnectTime, uint32_t duration)
+        : userId_(userId),
           sessionPort_(port),
-          connectTime_(std::move(connectTime)),
-          disconnectTime_(std::move(disconnectTime)),
-          duration_(std::move(duration)),
-          timeToday_(std::move(timeToday))
+          duration_(duration),
+          connectTime_(connectTime),
+          disconnectTime_(disconnectTime)
 {}
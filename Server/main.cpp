@@ -1,4 +1,5 @@
 #include <iostream>
+#include <sstream>
 #include "../Server/TCP/inc/header.h"
 
 //#define DEGUGLOG
@@ -18,7 +19,7 @@ std::atomic<bool> exitRequested(false);
 
 Server server(8081,
               {1, 1, 1},
-              [](DataBuffer_t dataBuffer, Server::InterfaceClientSession& client){
+              [](const DataBuffer_t& dataBuffer, Server::InterfaceClientSession& client){
 #ifdef DEGUGLOG
                   std::cout << "Client " << getHostStr(client) << " send data [ " << dataBuffer.size() << "bytes ]: " << (char*)dataBuffer.data() << '\n';
 #endif
@@ -31,7 +32,6 @@ Server server(8081,
               [](Server::InterfaceClientSession& client){
                   std::cout << "Client " << getHostStr(client) << " disconnected\n";
                   client.OnDisconnect(client, server);
-                  Server::InterfaceClientSession::WriteToDB(client, server);
               },
               std::thread::hardware_concurrency()
 );
@@ -45,6 +45,26 @@ void serverIOThread(Server &server) {
             server.ServerDisconnectAll();
         } else if (command == "print") {
             server.printAllUsersInfo();
+        } else if (command == "sessions" || command.rfind("sessions ", 0) == 0) {
+            server.printSessionCounts(command.size() > 9 ? command.substr(9) : "");
+        } else if (command == "stats") {
+            server.printBufferPoolStats();
+            server.printFrameStats();
+            server.printRateLimitStats();
+            server.printAdmissionStats();
+            server.printWriterStats();
+            server.printDatabaseStats();
+        } else if (command.rfind("time ", 0) == 0) {
+            std::istringstream iss(command);
+            std::string name, username, date;
+            int64_t day, seconds;
+            iss >> name >> username >> date;
+            if (!ParseSessionDay(date, day)) {
+                std::cout << "Usage: time <username> <YYYY-MM-DD>" << std::endl;
+            } else if (server.QueryUserTime(username, day, seconds)) {
+                std::cout << "Total connection time for user " << username << " on " << date << ": "
+                          << Server::FormatDuration(static_cast<uint32_t>(seconds)) << std::endl;
+            }
         }
     }
 }
@@ -54,6 +74,17 @@ int main() {
 
     std::cout << "Hello, World, Iam Server" << std::endl;
 
+    server.SetServerTelemetryHandler([](const PcDataRecord& record, Server::InterfaceClientSession& client){
+        std::cout << "Client " << getHostStr(client) << " telemetry: user " << record.user_
+                  << " machine " << record.machine_ << " ip " << record.ip_ << '\n';
+    });
+    server.SetServerStreamHandler([]([[maybe_unused]] const StreamChunk& chunk, [[maybe_unused]] Server::InterfaceClientSession& client){
+#ifdef DEGUGLOG
+        std::cout << "Client " << getHostStr(client) << " stream " << chunk.streamId
+                  << " chunk [ " << chunk.Size() << "bytes ]" << (chunk.IsEnd() ? " end" : "") << '\n';
+#endif
+    });
+
     if (server.StartServer() == SocketStatusInfo::Connected) {
         std::cout << "Server listening on port: " << server.GetServerPort() << '\n'
                   << "Server handling thread pool size: " << server.GetThreadExecutor().GetThreadCount() << std::endl;
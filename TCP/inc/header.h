@@ -17,13 +17,19 @@
 #include <iostream>
 
 #include <queue>
+#include <deque>
 #include <vector>
+#include <array>
+#include <memory>
+#include <unordered_map>
 
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <cstdlib>
 #include <condition_variable>
+#include <chrono>
+#include <string>
 
 
 #define HARDWARE_CONCURRENCY std::thread::hardware_concurrency()
@@ -55,6 +61,269 @@ enum class SocketStatusInfo : uint8_t {
 
 typedef std::vector<uint8_t> DataBuffer_t;
 
+// Wall clock refreshed by a background tick. Readers get the cached epoch and the
+// pre-formatted local "YYYY-MM-DD HH:MM:SS" of the current second without calling
+// localtime or taking a lock; the text is published through a seqlock of atomic words.
+// The tick only runs once StartTicking has been called (the server does, the client does not);
+// until then every reader falls back to the system clock.
+// Other timestamps are formatted with the UTC offset in force at that epoch, so a value on
+// the far side of a DST switch keeps its own offset.
+class CoarseClock {
+public:
+    static constexpr std::chrono::milliseconds kTickInterval{1};
+
+    static CoarseClock& Instance();
+    ~CoarseClock();
+
+    void StartTicking();
+
+    [[nodiscard]] int64_t NowMilliseconds() const {
+        return m_ticking_.load(std::memory_order_acquire) ? m_nowMilliseconds_.load(std::memory_order_relaxed)
+                                                          : SystemMilliseconds();
+    };
+    [[nodiscard]] int64_t NowSeconds() const {return NowMilliseconds() / 1000;};
+    [[nodiscard]] int64_t GetUtcOffset() const;
+    static int64_t GetUtcOffsetAt(int64_t epoch);
+
+    [[nodiscard]] std::string DateNow() const;
+    [[nodiscard]] std::string DateTimeNow() const;
+    [[nodiscard]] std::string FormatDate(int64_t epoch) const;
+    [[nodiscard]] std::string FormatDateTime(int64_t epoch) const;
+
+    static constexpr size_t kDateTimeLength = 19;
+
+private:
+    CoarseClock() = default;
+    static int64_t SystemMilliseconds();
+    void TickLoop();
+    void Refresh(int64_t milliseconds);
+    static void FormatInto(int64_t epoch, char* out);
+
+    std::atomic<int64_t> m_nowMilliseconds_ = 0;
+    std::atomic<int64_t> m_utcOffset_ = 0;
+    int64_t m_formattedSecond_ = -1;
+
+    std::atomic<uint32_t> m_sequence_ = 0;
+    std::array<std::atomic<uint64_t>, 3> m_dateTimeWords_{};
+
+    std::mutex m_startMutex_;
+    std::atomic<bool> m_ticking_ = false;
+    std::atomic<bool> m_running_ = true;
+    std::thread m_tickThread_;
+};
+
+// Read-write shared mapping of a whole file. Open creates or grows the file to the requested
+// size; a size of zero maps the file as it is and fails when it is empty.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path, size_t size = 0);
+    void Close();
+    bool Flush(bool synchronous = false) const;
+
+    [[nodiscard]] bool IsOpen() const {return m_data_ != nullptr;};
+    [[nodiscard]] uint8_t* Data() const {return m_data_;};
+    [[nodiscard]] size_t Size() const {return m_size_;};
+
+private:
+    uint8_t* m_data_ = nullptr;
+    size_t m_size_ = 0;
+#ifdef _WIN32
+    void* m_file_ = nullptr;
+    void* m_mapping_ = nullptr;
+#else
+    int m_file_ = -1;
+#endif
+};
+
+// Size-class pool for frame buffers: 256 B .. 1 MiB in 2x steps, so a buffer is at most twice its
+// request. Each thread keeps a few buffers per class and falls back to a shared, mutex-guarded
+// backstop before allocating.
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t localHits = 0;
+        uint64_t sharedHits = 0;
+        uint64_t misses = 0;
+        uint64_t oversized = 0;
+        uint64_t released = 0;
+        uint64_t dropped = 0;
+
+        [[nodiscard]] double HitRate() const {
+            uint64_t total = localHits + sharedHits + misses + oversized;
+            return total ? static_cast<double>(localHits + sharedHits) / static_cast<double>(total) : 0.0;
+        }
+    };
+
+    static constexpr size_t kSizeClassCount = 13;
+    static constexpr size_t kSmallestClassSize = 256;
+    static constexpr size_t kLocalCacheDepth = 8;
+    static constexpr size_t kSharedCacheDepth = 64;
+
+    static BufferPool& Instance();
+
+    DataBuffer_t Acquire(size_t size);
+    void Release(DataBuffer_t&& buffer);
+    std::shared_ptr<DataBuffer_t> AcquireShared(size_t size);
+
+    [[nodiscard]] Stats GetStats() const;
+
+    static constexpr size_t GetClassSize(size_t size_class) {
+        return kSmallestClassSize << size_class;
+    }
+
+private:
+    friend struct LocalBufferCache;
+
+    struct SharedClass {
+        std::mutex mutex;
+        std::vector<DataBuffer_t> buffers;
+    };
+
+    BufferPool() = default;
+    bool TakeShared(size_t size_class, DataBuffer_t& buffer);
+    void PutShared(size_t size_class, DataBuffer_t&& buffer);
+
+    std::array<SharedClass, kSizeClassCount> m_shared_;
+    std::atomic<uint64_t> m_localHits_ = 0;
+    std::atomic<uint64_t> m_sharedHits_ = 0;
+    std::atomic<uint64_t> m_misses_ = 0;
+    std::atomic<uint64_t> m_oversized_ = 0;
+    std::atomic<uint64_t> m_released_ = 0;
+    std::atomic<uint64_t> m_dropped_ = 0;
+};
+
+// Frame header: the high byte carries the frame type, the low 24 bits the payload length.
+// Type 0 keeps old "plain length prefix" peers compatible for frames below 16 MiB.
+enum class FrameType : uint8_t {
+    Data                = 0,
+    StreamChunk         = 1,
+    StreamWindow        = 2,
+    Telemetry           = 3,
+    Error               = 4,
+    PresenceSubscribe   = 5,
+    Presence            = 6
+};
+
+constexpr uint32_t kFrameLengthBits = 24;
+constexpr uint32_t kFrameLengthMask = (1u << kFrameLengthBits) - 1;
+
+constexpr uint32_t MakeFrameHeader(FrameType type, uint32_t length) {
+    return (static_cast<uint32_t>(type) << kFrameLengthBits) | (length & kFrameLengthMask);
+}
+
+constexpr FrameType GetFrameType(uint32_t header) {
+    return static_cast<FrameType>(header >> kFrameLengthBits);
+}
+
+constexpr uint32_t GetFrameLength(uint32_t header) {
+    return header & kFrameLengthMask;
+}
+
+// Non-owning window into a receive buffer. recv() writes the frame straight into that buffer and
+// nothing copies it again in user space. Copies of the view share a lease on the buffer; when the
+// last one is dropped the lease's deleter hands the buffer back to the session. Retain() detaches the bytes.
+class DataView {
+public:
+    DataView() = default;
+    DataView(std::shared_ptr<const DataBuffer_t> lease, size_t offset, size_t size)
+        : m_lease_(std::move(lease)), m_data_(m_lease_->data() + offset), m_size_(size) {}
+
+    [[nodiscard]] const uint8_t* Data() const {return m_data_;};
+    [[nodiscard]] size_t Size() const {return m_size_;};
+    [[nodiscard]] bool Empty() const {return !m_size_;};
+    [[nodiscard]] const uint8_t* begin() const {return m_data_;};
+    [[nodiscard]] const uint8_t* end() const {return m_data_ + m_size_;};
+
+    [[nodiscard]] DataBuffer_t Retain() const {return DataBuffer_t(begin(), end());};
+    [[nodiscard]] std::shared_ptr<const DataBuffer_t> Lease() const {return m_lease_;};
+
+private:
+    std::shared_ptr<const DataBuffer_t> m_lease_;
+    const uint8_t* m_data_ = nullptr;
+    size_t m_size_ = 0;
+};
+
+// Sent as the single byte payload of an Error frame right before the connection is closed.
+enum class ProtocolError : uint8_t {
+    None                = 0,
+    FrameTooLarge       = 1,
+    UnknownFrameType    = 2,
+    MalformedPayload    = 3,
+    StreamViolation     = 4,
+    RateLimited         = 5,
+    AdmissionRejected   = 6,
+    NotAuthenticated    = 7
+};
+
+constexpr size_t kProtocolErrorCount = 8;
+
+// Per-type payload limits checked against the raw header before anything is allocated.
+// A zero limit marks a type the receiver does not accept at all.
+class FrameLimits {
+public:
+    static constexpr uint32_t kDefaultMaxFrameSize = 1024 * 1024;
+
+    explicit FrameLimits(uint32_t max_data_size = kDefaultMaxFrameSize);
+
+    void SetLimit(FrameType type, uint32_t size);
+    void SetMaxFrameSize(uint32_t size);
+    [[nodiscard]] uint32_t GetLimit(FrameType type) const {return m_limits_[static_cast<uint8_t>(type)];};
+
+    [[nodiscard]] ProtocolError Validate(uint32_t header) const {
+        uint32_t limit = m_limits_[header >> kFrameLengthBits];
+        if (GetFrameLength(header) <= limit) {
+            return ProtocolError::None;
+        }
+        return limit ? ProtocolError::FrameTooLarge : ProtocolError::UnknownFrameType;
+    }
+
+private:
+    std::array<uint32_t, 1u << (32 - kFrameLengthBits)> m_limits_{};
+};
+
+struct Frame {
+    FrameType type = FrameType::Data;
+    ProtocolError error = ProtocolError::None;
+    DataBuffer_t payload;
+    DataView view;
+
+    [[nodiscard]] bool Empty() const {return payload.empty() && view.Empty();};
+};
+
+// Stream chunk payload: [uint32 stream id][uint8 flags][data...]
+// Stream window payload: [uint32 stream id][uint32 credit in bytes]
+enum StreamFlags : uint8_t {
+    kStreamBegin    = 1 << 0,
+    kStreamEnd      = 1 << 1
+};
+
+constexpr size_t kStreamChunkHeaderSize = sizeof(uint32_t) + sizeof(uint8_t);
+constexpr size_t kStreamWindowSize = sizeof(uint32_t) + sizeof(uint32_t);
+constexpr uint32_t kStreamChunkSize = 64 * 1024;
+constexpr uint32_t kStreamInitialWindow = 1024 * 1024;
+
+// Keeps the whole frame payload, the data starts after the chunk header.
+struct StreamChunk {
+    uint32_t streamId = 0;
+    uint8_t flags = 0;
+    DataBuffer_t payload;
+
+    [[nodiscard]] const uint8_t* Data() const {return payload.data() + kStreamChunkHeaderSize;};
+    [[nodiscard]] size_t Size() const {return payload.size() - kStreamChunkHeaderSize;};
+    [[nodiscard]] bool IsBegin() const {return flags & kStreamBegin;};
+    [[nodiscard]] bool IsEnd() const {return flags & kStreamEnd;};
+};
+
+bool ParseStreamChunk(DataBuffer_t payload, StreamChunk& chunk);
+bool ParseStreamWindow(const DataBuffer_t& payload, uint32_t& stream_id, uint32_t& credit);
+DataBuffer_t MakeStreamWindow(uint32_t stream_id, uint32_t credit);
+
 enum class ConnectionType : uint8_t {
     Client = 0,
     Server = 1
@@ -79,7 +348,7 @@ public:
         }
         {
             std::unique_lock lock(m_queueMutex_);
-            m_queueWork_.push(std::function<void()>(work));
+            m_queueWork_.push(std::function<void()>(std::move(work)));
         }
         m_conditionVariable_.notify_all();
     }
@@ -126,6 +395,14 @@ namespace {
 }
 #endif
 
+// Give up when the whole buffer has not moved within the timeout.
+constexpr std::chrono::milliseconds kSocketIoTimeout(30000);
+
+bool ReceiveExact(SocketHandle_t socket, void* buffer, size_t size,
+                  std::chrono::milliseconds timeout = kSocketIoTimeout);
+bool SendExact(SocketHandle_t socket, const void* buffer, size_t size,
+               std::chrono::milliseconds timeout = kSocketIoTimeout);
+
 class TCPInterfaceBase {
 public:
     typedef SocketStatusInfo SockStatusInfo_t;
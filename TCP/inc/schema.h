@@ -0,0 +1,163 @@
+#ifndef ALL_SCHEMA_H
+#define ALL_SCHEMA_H
+
+#include "header.h"
+
+#include <string>
+#include <type_traits>
+
+// Compact binary layout generated from member pointers. Integers and enums are written at
+// their native width, strings as a uint16 length followed by the bytes. Decode checks the
+// fixed part once, then only the variable-length fields need a bounds check of their own.
+
+template<typename T>
+struct MemberTraits;
+
+template<typename C, typename M>
+struct MemberTraits<M C::*> {
+    using Class = C;
+    using Type = M;
+};
+
+template<typename T, typename = void>
+struct FieldCodec;
+
+template<typename T>
+struct FieldCodec<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>> {
+    static constexpr size_t kFixedSize = sizeof(T);
+
+    static size_t Size(const T&) {return sizeof(T);}
+
+    static bool Write(uint8_t*& out, const T& value) {
+        memcpy(out, &value, sizeof(T));
+        out += sizeof(T);
+        return true;
+    }
+
+    static bool Read(const uint8_t*& in, size_t&, T& value) {
+        memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        return true;
+    }
+};
+
+template<>
+struct FieldCodec<std::string> {
+    static constexpr size_t kFixedSize = sizeof(uint16_t);
+    static constexpr size_t kMaxLength = UINT16_MAX;
+
+    static size_t Size(const std::string& value) {return sizeof(uint16_t) + value.size();}
+
+    static bool Write(uint8_t*& out, const std::string& value) {
+        if (value.size() > kMaxLength) {
+            return false;
+        }
+        auto length = static_cast<uint16_t>(value.size());
+        memcpy(out, &length, sizeof(length));
+        memcpy(out + sizeof(length), value.data(), length);
+        out += sizeof(length) + length;
+        return true;
+    }
+
+    static bool Read(const uint8_t*& in, size_t& budget, std::string& value) {
+        uint16_t length;
+        memcpy(&length, in, sizeof(length));
+        if (length > budget) {
+            return false;
+        }
+        value.assign(reinterpret_cast<const char*>(in + sizeof(length)), length);
+        in += sizeof(length) + length;
+        budget -= length;
+        return true;
+    }
+};
+
+template<auto Member>
+struct SchemaField {
+    using Class = typename MemberTraits<decltype(Member)>::Class;
+    using Type = typename MemberTraits<decltype(Member)>::Type;
+    using Codec = FieldCodec<Type>;
+
+    static constexpr size_t kFixedSize = Codec::kFixedSize;
+
+    static size_t Size(const Class& message) {return Codec::Size(message.*Member);}
+    static bool Write(uint8_t*& out, const Class& message) {return Codec::Write(out, message.*Member);}
+    static bool Read(const uint8_t*& in, size_t& budget, Class& message) {return Codec::Read(in, budget, message.*Member);}
+};
+
+template<typename T, typename... Fields>
+struct MessageSchema {
+    static_assert((std::is_same_v<typename Fields::Class, T> && ...), "schema fields must belong to the message type");
+
+    static constexpr size_t kMinSize = (Fields::kFixedSize + ... + 0);
+
+    static size_t EncodedSize(const T& message) {
+        return (Fields::Size(message) + ... + 0);
+    }
+
+    // Appends the encoded message to out.
+    static bool Encode(const T& message, DataBuffer_t& out) {
+        size_t offset = out.size();
+        out.resize(offset + EncodedSize(message));
+        uint8_t* position = out.data() + offset;
+        if (!(Fields::Write(position, message) && ...)) {
+            out.resize(offset);
+            return false;
+        }
+        return true;
+    }
+
+    static bool Decode(const uint8_t* data, size_t size, T& message) {
+        if (size < kMinSize) {
+            return false;
+        }
+        size_t budget = size - kMinSize;
+        return (Fields::Read(data, budget, message) && ...) && !budget;
+    }
+
+    static bool Decode(const DataBuffer_t& data, T& message) {
+        return Decode(data.data(), data.size(), message);
+    }
+};
+
+struct PcDataRecord {
+    int64_t timestamp_ = 0;
+    std::string user_;
+    std::string domain_;
+    std::string machine_;
+    std::string ip_;
+};
+
+using PcDataSchema = MessageSchema<PcDataRecord,
+        SchemaField<&PcDataRecord::timestamp_>,
+        SchemaField<&PcDataRecord::user_>,
+        SchemaField<&PcDataRecord::domain_>,
+        SchemaField<&PcDataRecord::machine_>,
+        SchemaField<&PcDataRecord::ip_>>;
+
+enum class PresenceState : uint8_t {
+    Offline = 0,
+    Online  = 1
+};
+
+struct PresenceRecord {
+    std::string user_;
+    PresenceState state_ = PresenceState::Offline;
+    int64_t changedAt_ = 0;
+};
+
+using PresenceSchema = MessageSchema<PresenceRecord,
+        SchemaField<&PresenceRecord::user_>,
+        SchemaField<&PresenceRecord::state_>,
+        SchemaField<&PresenceRecord::changedAt_>>;
+
+struct PresenceSubscribeRecord {
+    uint8_t subscribe_ = 1;
+    std::string user_;
+};
+
+using PresenceSubscribeSchema = MessageSchema<PresenceSubscribeRecord,
+        SchemaField<&PresenceSubscribeRecord::subscribe_>,
+        SchemaField<&PresenceSubscribeRecord::user_>>;
+
+#endif //ALL_SCHEMA_H
@@ -1,5 +1,19 @@
 #include "../inc/header.h"
 
+#include <algorithm>
+#include <ctime>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <poll.h>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
 NetworkThreadPool::~NetworkThreadPool() {
     m_terminatePool_ = true;
     JoinThreads();
@@ -21,7 +35,7 @@ void NetworkThreadPool::ThreadWorkerLoop() {
             if (m_terminatePool_) {
                 return;
             }
-            work = m_queueWork_.front();
+            work = std::move(m_queueWork_.front());
             m_queueWork_.pop();
         }
         work();
@@ -56,4 +70,453 @@ void NetworkThreadPool::StartThreads(uint32_t thread_count) {
         m_terminatePool_ = false;
         ConfigureThreadPool(thread_count);
     }
-}
\ No newline at end of file
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string& path, size_t size) {
+    Close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || (!size && !fileSize.QuadPart)) {
+        CloseHandle(file);
+        return false;
+    }
+    size = std::max<size_t>(size, static_cast<size_t>(fileSize.QuadPart));
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+                                        static_cast<DWORD>(size), nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    m_file_ = file;
+    m_mapping_ = mapping;
+    m_data_ = static_cast<uint8_t*>(data);
+    m_size_ = size;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (m_data_) {
+        UnmapViewOfFile(m_data_);
+        CloseHandle(m_mapping_);
+        CloseHandle(m_file_);
+    }
+    m_data_ = nullptr;
+    m_size_ = 0;
+    m_file_ = nullptr;
+    m_mapping_ = nullptr;
+}
+
+bool MappedFile::Flush(bool synchronous) const {
+    if (!m_data_ || !FlushViewOfFile(m_data_, m_size_)) {
+        return false;
+    }
+    return !synchronous || FlushFileBuffers(m_file_);
+}
+#else
+bool MappedFile::Open(const std::string& path, size_t size) {
+    Close();
+    int file = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info{};
+    if (fstat(file, &info) != 0 || (!size && !info.st_size)) {
+        close(file);
+        return false;
+    }
+    // The blocks are allocated up front: a sparse file would only run out of space on a later store
+    // into the mapping, which raises SIGBUS instead of returning an error.
+    if (size > static_cast<size_t>(info.st_size)) {
+        if (posix_fallocate(file, info.st_size, static_cast<off_t>(size) - info.st_size) != 0) {
+            close(file);
+            return false;
+        }
+    } else {
+        size = static_cast<size_t>(info.st_size);
+    }
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (data == MAP_FAILED) {
+        close(file);
+        return false;
+    }
+    m_file_ = file;
+    m_data_ = static_cast<uint8_t*>(data);
+    m_size_ = size;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (m_data_) {
+        munmap(m_data_, m_size_);
+        close(m_file_);
+    }
+    m_data_ = nullptr;
+    m_size_ = 0;
+    m_file_ = -1;
+}
+
+bool MappedFile::Flush(bool synchronous) const {
+    return m_data_ && msync(m_data_, m_size_, synchronous ? MS_SYNC : MS_ASYNC) == 0;
+}
+#endif
+
+int64_t CoarseClock::SystemMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int64_t LocalTime(int64_t epoch, std::tm& local) {
+    std::time_t t = static_cast<std::time_t>(epoch);
+#ifdef _WIN32
+    localtime_s(&local, &t);
+    std::tm utc{};
+    gmtime_s(&utc, &t);
+    utc.tm_isdst = local.tm_isdst;
+    std::tm copy = local;
+    return static_cast<int64_t>(std::mktime(&copy) - std::mktime(&utc));
+#else
+    localtime_r(&t, &local);
+    return local.tm_gmtoff;
+#endif
+}
+
+CoarseClock& CoarseClock::Instance() {
+    static CoarseClock clock;
+    return clock;
+}
+
+CoarseClock::~CoarseClock() {
+    m_running_ = false;
+    if (m_tickThread_.joinable()) {
+        m_tickThread_.join();
+    }
+}
+
+void CoarseClock::StartTicking() {
+    std::lock_guard lock(m_startMutex_);
+    if (m_tickThread_.joinable()) {
+        return;
+    }
+    Refresh(SystemMilliseconds());
+    m_ticking_.store(true, std::memory_order_release);
+    m_tickThread_ = std::thread(&CoarseClock::TickLoop, this);
+}
+
+void CoarseClock::TickLoop() {
+    while (m_running_) {
+        std::this_thread::sleep_for(kTickInterval);
+        Refresh(SystemMilliseconds());
+    }
+}
+
+void CoarseClock::Refresh(int64_t milliseconds) {
+    m_nowMilliseconds_.store(milliseconds, std::memory_order_relaxed);
+    int64_t second = milliseconds / 1000;
+    if (second == m_formattedSecond_) {
+        return;
+    }
+    m_formattedSecond_ = second;
+
+    std::tm local{};
+    m_utcOffset_.store(LocalTime(second, local), std::memory_order_relaxed);
+
+    char text[sizeof(uint64_t) * 3] = {};
+    std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    uint64_t words[3];
+    memcpy(words, text, sizeof(words));
+
+    m_sequence_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < m_dateTimeWords_.size(); ++i) {
+        m_dateTimeWords_[i].store(words[i], std::memory_order_relaxed);
+    }
+    m_sequence_.fetch_add(1, std::memory_order_release);
+}
+
+int64_t CoarseClock::GetUtcOffset() const {
+    if (m_ticking_.load(std::memory_order_acquire)) {
+        return m_utcOffset_.load(std::memory_order_relaxed);
+    }
+    return GetUtcOffsetAt(SystemMilliseconds() / 1000);
+}
+
+int64_t CoarseClock::GetUtcOffsetAt(int64_t epoch) {
+    std::tm local{};
+    return LocalTime(epoch, local);
+}
+
+std::string CoarseClock::DateTimeNow() const {
+    if (!m_ticking_.load(std::memory_order_acquire)) {
+        return FormatDateTime(SystemMilliseconds() / 1000);
+    }
+    uint64_t words[3];
+    uint32_t sequence;
+    do {
+        sequence = m_sequence_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < m_dateTimeWords_.size(); ++i) {
+            words[i] = m_dateTimeWords_[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) || sequence != m_sequence_.load(std::memory_order_relaxed));
+    return std::string(reinterpret_cast<const char*>(words), kDateTimeLength);
+}
+
+std::string CoarseClock::DateNow() const {
+    return DateTimeNow().substr(0, 10);
+}
+
+// Writes exactly kDateTimeLength characters and the terminator; a year past 9999 prints as zeros.
+void CoarseClock::FormatInto(int64_t epoch, char* out) {
+    std::tm local{};
+    LocalTime(epoch, local);
+    if (std::strftime(out, kDateTimeLength + 1, "%Y-%m-%d %H:%M:%S", &local) != kDateTimeLength) {
+        memcpy(out, "0000-00-00 00:00:00", kDateTimeLength + 1);
+    }
+}
+
+std::string CoarseClock::FormatDateTime(int64_t epoch) const {
+    char text[kDateTimeLength + 1];
+    FormatInto(epoch, text);
+    return std::string(text, kDateTimeLength);
+}
+
+std::string CoarseClock::FormatDate(int64_t epoch) const {
+    char text[kDateTimeLength + 1];
+    FormatInto(epoch, text);
+    return std::string(text, 10);
+}
+
+struct LocalBufferCache {
+    std::array<std::vector<DataBuffer_t>, BufferPool::kSizeClassCount> buffers;
+
+    ~LocalBufferCache() {
+        for (size_t sizeClass = 0; sizeClass < buffers.size(); ++sizeClass) {
+            for (auto& buffer : buffers[sizeClass]) {
+                BufferPool::Instance().PutShared(sizeClass, std::move(buffer));
+            }
+        }
+    }
+};
+
+static thread_local LocalBufferCache localBufferCache;
+
+BufferPool& BufferPool::Instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+DataBuffer_t BufferPool::Acquire(size_t size) {
+    size_t sizeClass = 0;
+    while (sizeClass < kSizeClassCount && GetClassSize(sizeClass) < size) {
+        ++sizeClass;
+    }
+    DataBuffer_t buffer;
+    if (sizeClass == kSizeClassCount) {
+        m_oversized_.fetch_add(1, std::memory_order_relaxed);
+    } else if (auto& local = localBufferCache.buffers[sizeClass]; !local.empty()) {
+        buffer = std::move(local.back());
+        local.pop_back();
+        m_localHits_.fetch_add(1, std::memory_order_relaxed);
+    } else if (TakeShared(sizeClass, buffer)) {
+        m_sharedHits_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        buffer.reserve(GetClassSize(sizeClass));
+        m_misses_.fetch_add(1, std::memory_order_relaxed);
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::Release(DataBuffer_t&& buffer) {
+    if (buffer.capacity() < kSmallestClassSize) {
+        return;
+    }
+    size_t sizeClass = 0;
+    while (sizeClass + 1 < kSizeClassCount && GetClassSize(sizeClass + 1) <= buffer.capacity()) {
+        ++sizeClass;
+    }
+    if (buffer.capacity() > 2 * GetClassSize(kSizeClassCount - 1)) {
+        m_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.clear();
+    m_released_.fetch_add(1, std::memory_order_relaxed);
+    if (auto& local = localBufferCache.buffers[sizeClass]; local.size() < kLocalCacheDepth) {
+        local.push_back(std::move(buffer));
+        return;
+    }
+    PutShared(sizeClass, std::move(buffer));
+}
+
+std::shared_ptr<DataBuffer_t> BufferPool::AcquireShared(size_t size) {
+    return std::shared_ptr<DataBuffer_t>(new DataBuffer_t(Acquire(size)), [](DataBuffer_t* buffer) {
+        BufferPool::Instance().Release(std::move(*buffer));
+        delete buffer;
+    });
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    Stats stats;
+    stats.localHits = m_localHits_.load(std::memory_order_relaxed);
+    stats.sharedHits = m_sharedHits_.load(std::memory_order_relaxed);
+    stats.misses = m_misses_.load(std::memory_order_relaxed);
+    stats.oversized = m_oversized_.load(std::memory_order_relaxed);
+    stats.released = m_released_.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool BufferPool::TakeShared(size_t size_class, DataBuffer_t& buffer) {
+    std::lock_guard lock(m_shared_[size_class].mutex);
+    auto& buffers = m_shared_[size_class].buffers;
+    if (buffers.empty()) {
+        return false;
+    }
+    buffer = std::move(buffers.back());
+    buffers.pop_back();
+    return true;
+}
+
+void BufferPool::PutShared(size_t size_class, DataBuffer_t&& buffer) {
+    std::lock_guard lock(m_shared_[size_class].mutex);
+    auto& buffers = m_shared_[size_class].buffers;
+    if (buffers.size() >= kSharedCacheDepth) {
+        m_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffers.push_back(std::move(buffer));
+}
+
+FrameLimits::FrameLimits(uint32_t max_data_size) {
+    SetLimit(FrameType::Data, max_data_size);
+    SetLimit(FrameType::StreamChunk, kStreamChunkHeaderSize + kStreamChunkSize);
+    SetLimit(FrameType::StreamWindow, kStreamWindowSize);
+    SetLimit(FrameType::Telemetry, 4 * 1024);
+    SetLimit(FrameType::Error, sizeof(ProtocolError));
+    SetLimit(FrameType::PresenceSubscribe, 512);
+    SetLimit(FrameType::Presence, 512);
+}
+
+void FrameLimits::SetLimit(FrameType type, uint32_t size) {
+    m_limits_[static_cast<uint8_t>(type)] = std::min(size, kFrameLengthMask);
+}
+
+void FrameLimits::SetMaxFrameSize(uint32_t size) {
+    for (auto& limit : m_limits_) {
+        if (limit > size) {
+            limit = size;
+        }
+    }
+    SetLimit(FrameType::Data, size);
+}
+
+bool ParseStreamChunk(DataBuffer_t payload, StreamChunk& chunk) {
+    if (payload.size() < kStreamChunkHeaderSize) {
+        return false;
+    }
+    memcpy(&chunk.streamId, payload.data(), sizeof(uint32_t));
+    chunk.flags = payload[sizeof(uint32_t)];
+    chunk.payload = std::move(payload);
+    return true;
+}
+
+bool ParseStreamWindow(const DataBuffer_t& payload, uint32_t& stream_id, uint32_t& credit) {
+    if (payload.size() != kStreamWindowSize) {
+        return false;
+    }
+    memcpy(&stream_id, payload.data(), sizeof(uint32_t));
+    memcpy(&credit, payload.data() + sizeof(uint32_t), sizeof(uint32_t));
+    return true;
+}
+
+DataBuffer_t MakeStreamWindow(uint32_t stream_id, uint32_t credit) {
+    DataBuffer_t payload(kStreamWindowSize);
+    memcpy(payload.data(), &stream_id, sizeof(uint32_t));
+    memcpy(payload.data() + sizeof(uint32_t), &credit, sizeof(uint32_t));
+    return payload;
+}
+
+// False on error or when the socket is still not ready at the deadline.
+static bool WaitSocket(SocketHandle_t socket, short events, std::chrono::steady_clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+        return false;
+    }
+    int timeout = static_cast<int>(std::min<int64_t>(left.count(), INT32_MAX));
+#ifdef _WIN32
+    WSAPOLLFD descriptor{socket, events, 0};
+    return WSAPoll(&descriptor, 1, timeout) > 0;
+#else
+    pollfd descriptor{socket, events, 0};
+    int answer = poll(&descriptor, 1, timeout);
+    return answer > 0 || (answer < 0 && errno == EINTR);
+#endif
+}
+
+// A peer that has gone away must fail the send, not raise SIGPIPE in the server.
+#ifdef _WIN32
+static constexpr int kSendFlags = 0;
+#else
+static constexpr int kSendFlags = MSG_NOSIGNAL;
+#endif
+
+static bool WouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+bool ReceiveExact(SocketHandle_t socket, void* buffer, size_t size, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto* position = reinterpret_cast<char*>(buffer);
+    while (size) {
+        int answer = recv(socket, position, static_cast<int>(size), 0);
+        if (answer == 0) {
+            return false;
+        }
+        if (answer < 0) {
+            if (!WouldBlock() || !WaitSocket(socket, POLLIN, deadline)) {
+                return false;
+            }
+            continue;
+        }
+        position += answer;
+        size -= static_cast<size_t>(answer);
+    }
+    return true;
+}
+
+bool SendExact(SocketHandle_t socket, const void* buffer, size_t size, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    const auto* position = reinterpret_cast<const char*>(buffer);
+    while (size) {
+        int answer = send(socket, position, static_cast<int>(size), kSendFlags);
+        if (answer < 0) {
+            if (!WouldBlock() || !WaitSocket(socket, POLLOUT, deadline)) {
+                return false;
+            }
+            continue;
+        }
+        position += answer;
+        size -= static_cast<size_t>(answer);
+    }
+    return true;
+}